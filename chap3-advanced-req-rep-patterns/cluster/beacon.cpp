@@ -0,0 +1,115 @@
+// cluster/beacon.cpp
+//
+#include "beacon.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+# include <arpa/inet.h>
+# include <netinet/in.h>
+# include <sys/socket.h>
+# include <unistd.h>
+# define closesocket close
+# define INVALID_SOCKET -1
+#endif // WIN32
+
+#include "peers.h"
+
+namespace {
+
+const char BEACON_MAGIC[] = "ZCB";
+const size_t BEACON_MAGIC_SIZE = 3;
+const unsigned char BEACON_VERSION = 1;
+const size_t BEACON_MAX = BEACON_MAGIC_SIZE + 3 + PEER_NAME_MAX;
+
+}
+
+struct beacon_t {
+    beacon_fd_t fd;
+    struct sockaddr_in broadcast;
+};
+
+beacon_t* beacon_new(int port, bool loopback)
+{
+    beacon_fd_t fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd == INVALID_SOCKET)
+        return 0;
+    // Several brokers on a host share the port; all of them get broadcasts
+    int on = 1;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&on, sizeof(on))
+            || setsockopt(fd, SOL_SOCKET, SO_BROADCAST, (char*)&on,
+                sizeof(on))
+            || bind(fd, (struct sockaddr*)&address, sizeof(address))) {
+        closesocket(fd);
+        return 0;
+    }
+
+    beacon_t* self = (beacon_t*)calloc(1, sizeof(beacon_t));
+    assert(self);
+    self->fd = fd;
+    self->broadcast = address;
+    self->broadcast.sin_addr.s_addr = htonl(loopback
+            ? 0x7FFFFFFF        // 127.255.255.255
+            : INADDR_BROADCAST);
+    return self;
+}
+
+void beacon_destroy(beacon_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        beacon_t* self = *self_p;
+        closesocket(self->fd);
+        free(self);
+        *self_p = 0;
+    }
+}
+
+beacon_fd_t beacon_fd(beacon_t* self)
+{
+    assert(self);
+    return self->fd;
+}
+
+bool beacon_send(beacon_t* self, const char* name, bool hello)
+{
+    assert(self);
+    assert(name);
+    size_t size = strlen(name);
+    assert(size <= (size_t)PEER_NAME_MAX);
+    char beacon[BEACON_MAX];
+    memcpy(beacon, BEACON_MAGIC, BEACON_MAGIC_SIZE);
+    beacon[BEACON_MAGIC_SIZE] = BEACON_VERSION;
+    beacon[BEACON_MAGIC_SIZE + 1] = hello ? 1 : 0;
+    beacon[BEACON_MAGIC_SIZE + 2] = (char)size;
+    memcpy(beacon + BEACON_MAGIC_SIZE + 3, name, size);
+    int rc = sendto(self->fd, beacon, (int)(BEACON_MAGIC_SIZE + 3 + size), 0,
+            (struct sockaddr*)&self->broadcast, sizeof(self->broadcast));
+    return rc >= 0;
+}
+
+bool beacon_recv(beacon_t* self, char* name, bool* hello)
+{
+    assert(self);
+    assert(name);
+    assert(hello);
+    unsigned char beacon[BEACON_MAX];
+    int size = recv(self->fd, (char*)beacon, sizeof(beacon), 0);
+    if (size < (int)BEACON_MAGIC_SIZE + 3
+            || memcmp(beacon, BEACON_MAGIC, BEACON_MAGIC_SIZE) != 0
+            || beacon[BEACON_MAGIC_SIZE] != BEACON_VERSION)
+        return false;
+    size_t name_size = beacon[BEACON_MAGIC_SIZE + 2];
+    if ((size_t)size != BEACON_MAGIC_SIZE + 3 + name_size)
+        return false;
+    memcpy(name, beacon + BEACON_MAGIC_SIZE + 3, name_size);
+    name[name_size] = 0;
+    *hello = beacon[BEACON_MAGIC_SIZE + 1] != 0;
+    return true;
+}
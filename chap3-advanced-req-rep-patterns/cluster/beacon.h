@@ -0,0 +1,43 @@
+// cluster/beacon.h
+//
+// UDP beacon, for brokers to discover each other without being told about
+// one another on the command line. Every broker broadcasts its name now and
+// then, and a farewell when it stops; a peer not heard from for a while is
+// gone. Broadcasts go to the local segment, or in loopback mode to
+// 127.255.255.255, so a cluster on one host can be tried out without a
+// network. Endpoints are derived from names, see endpoint.h, so peers found
+// on other hosts are only reachable if those resolve to them.
+// A beacon is the magic "ZCB", a version byte, 1 for hello or 0 for bye, the
+// length of the name in one byte, and the name.
+//
+#ifndef CLUSTER_BEACON_H_
+#define CLUSTER_BEACON_H_
+
+#include <stdint.h>
+
+#ifdef WIN32
+# include <winsock2.h>
+typedef SOCKET beacon_fd_t;
+#else
+typedef int beacon_fd_t;
+#endif // WIN32
+
+const int BEACON_PORT = 5670;
+const uint64_t BEACON_INTERVAL = 1000;  // msecs, between hellos
+const uint64_t BEACON_TTL = 3000;       // msecs, silence until a peer is gone
+
+struct beacon_t;
+
+// Open a beacon on the UDP port, returns null if that's not possible
+beacon_t* beacon_new(int port = BEACON_PORT, bool loopback = false);
+void beacon_destroy(beacon_t** self_p);
+// Socket to poll for beacons of others, as a zmq_pollitem_t fd
+beacon_fd_t beacon_fd(beacon_t* self);
+
+// Broadcast a hello, or a bye, for the name
+bool beacon_send(beacon_t* self, const char* name, bool hello);
+// Receive a beacon, name takes PEER_NAME_MAX + 1 bytes; returns false if
+// there was none, or it's not ours
+bool beacon_recv(beacon_t* self, char* name, bool* hello);
+
+#endif // CLUSTER_BEACON_H_
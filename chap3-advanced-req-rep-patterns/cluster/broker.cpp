@@ -0,0 +1,1322 @@
+// cluster/broker.cpp
+//
+#include "broker.h"
+
+#include <czmq.h>
+#include "czmq_fix.h"
+#include <assert.h>
+#include <stdlib.h>
+
+#include "beacon.h"
+#include "direct.h"
+#include "endpoint.h"
+#include "gossip.h"
+#include "hops.h"
+#include "loadgen.h"
+#include "metrics.h"
+#include "slab.h"
+#include "state.h"
+
+namespace {  // Internal
+
+const int NBR_CLIENTS = 10;
+const int NBR_WORKERS = 5;
+const char WORKER_READY[] = "\001";  // Signal that worker is ready
+const int STOP_CHECK = 100;  // msecs, how often idle tasks check for stop
+const int CLIENT_TIMEOUT = 10000;   // msecs, clients give up on tasks then
+const int CLIENT_OUTSTANDING = 256; // Tasks of an open loop client at once
+
+// Commands on the pipes between the threads of a threaded broker: a byte,
+// a value as 2 bytes in network order, and a peer name
+const char PIPE_UPDATE = 'U';       // To router: peer reported capacity
+const char PIPE_ATTACH = 'A';       // To router: peer came
+const char PIPE_DETACH = 'D';       // To router: peer is gone
+const char PIPE_CAPACITY = 'C';     // To state flow: our local capacity
+const char PIPE_TERM = 'T';         // To state flow and monitor: stop;
+                                    // from them: stopped
+
+bool s_stopped(const broker_config_t* config)
+{
+    return config->stop && *config->stop;
+}
+
+// Context for the broker or one of its tasks: a shadow of the shared one,
+// so that inproc endpoints reach across brokers, or one of its own
+zctx_t* s_ctx_new(const broker_config_t* config)
+{
+    return config->ctx ? zctx_shadow((zctx_t*)config->ctx) : zctx_new();
+}
+
+void s_pipe_send(void* pipe, char command, int value, const char* name)
+{
+    unsigned char data[3 + PEER_NAME_MAX];
+    size_t size = strlen(name);
+    assert(size <= (size_t)PEER_NAME_MAX);
+    data[0] = (unsigned char)command;
+    data[1] = (unsigned char)(value >> 8);
+    data[2] = (unsigned char)value;
+    memcpy(data + 3, name, size);
+    zmq_send(pipe, data, 3 + size, 0);
+}
+
+// Receive a command, name takes PEER_NAME_MAX + 1 bytes; returns false if
+// interrupted
+bool s_pipe_recv(void* pipe, char* command, int* value, char* name)
+{
+    unsigned char data[3 + PEER_NAME_MAX];
+    int size = zmq_recv(pipe, data, sizeof(data), 0);
+    if (size < 3)
+        return false;
+    *command = (char)data[0];
+    *value = (data[1] << 8) | data[2];
+    memcpy(name, data + 3, size - 3);
+    name[size - 3] = 0;
+    return true;
+}
+
+// Queue of available workers. Its nodes come from a pool, so that once warmed
+// up, queueing and dispatching workers takes nothing from the heap
+struct worker_node_t {
+    worker_node_t* next;
+    zframe_t* identity;
+};
+
+struct worker_queue_t {
+    worker_node_t* head;
+    worker_node_t* tail;
+    slab_t* pool;
+};
+
+void worker_queue_push(worker_queue_t* queue, zframe_t* identity)
+{
+    worker_node_t* node = (worker_node_t*)slab_alloc(queue->pool);
+    node->identity = identity;
+    if (queue->tail)
+        queue->tail->next = node;
+    else
+        queue->head = node;
+    queue->tail = node;
+}
+
+zframe_t* worker_queue_pop(worker_queue_t* queue)
+{
+    worker_node_t* node = queue->head;
+    if (!node)
+        return 0;
+    queue->head = node->next;
+    if (!queue->head)
+        queue->tail = 0;
+    zframe_t* identity = node->identity;
+    slab_free(queue->pool, node);
+    return identity;
+}
+
+// Push the metrics of a task to the monitor
+void s_metrics_send(void* monitor, const metrics_t* metrics)
+{
+    unsigned char data[METRICS_MSG_SIZE];
+    metrics_encode(data, metrics);
+    zmq_send(monitor, data, METRICS_MSG_SIZE, 0);
+}
+
+// Take path and dequeue time from the stamps of the routers a task went
+// through, which follow the task id in its reply: the first one tells its
+// path, the last one when a worker took it
+void s_metrics_stamps(zmsg_t* reply, metrics_t* metrics)
+{
+    metrics->path = METRICS_LOCAL;
+    metrics->dequeued_at = metrics->enqueued_at;
+    int64_t dispatched_at;
+    metrics_path_t path;
+    bool first = true;
+    for (zframe_t* stamp = zmsg_first(reply); stamp;
+            stamp = zmsg_next(reply)) {
+        if (!metrics_stamp_decode(zframe_data(stamp), zframe_size(stamp),
+                    &dispatched_at, &path))
+            continue;
+        if (first)
+            metrics->path = path;
+        first = false;
+        metrics->dequeued_at = dispatched_at;
+    }
+}
+
+// Where a client sends its tasks: to the frontend of its broker, or with
+// direct routing, to that of whichever broker has spare capacity, see
+// direct.h. Replies come from the frontend the task went to
+struct client_route_t {
+    direct_client_t* direct;    // Null to send all tasks to our broker
+    void* frontend;             // Of our broker, without direct routing
+    bool dealer;                // Tasks go with an empty delimiter frame
+    zmq_pollitem_t* items;      // Frontends, ours first
+    int nbr_items;
+};
+
+// Set up the route of a client, over a DEALER socket, or a REQ one if the
+// client has a single task outstanding and doesn't route directly
+void client_route_init(client_route_t* self, zctx_t* ctx,
+        const broker_config_t* config, bool dealer)
+{
+    memset(self, 0, sizeof(client_route_t));
+    if (config->direct) {
+        self->direct = direct_client_new(ctx, config->self, config->peers,
+                config->nbr_peers, config->policy);
+        self->dealer = true;
+        self->nbr_items = direct_client_size(self->direct);
+    } else {
+        char endpoint[256];
+        self->frontend = zsocket_new(ctx, dealer ? ZMQ_DEALER : ZMQ_REQ);
+        zsocket_connect(self->frontend,
+                localfe_endpoint(config->self, endpoint));
+        self->dealer = dealer;
+        self->nbr_items = 1;
+    }
+    self->items =
+        (zmq_pollitem_t*)calloc(self->nbr_items, sizeof(zmq_pollitem_t));
+    assert(self->items);
+    for (int i = 0; i < self->nbr_items; ++i) {
+        self->items[i].socket = self->direct
+            ? direct_client_frontend(self->direct, i) : self->frontend;
+        self->items[i].events = ZMQ_POLLIN;
+    }
+}
+
+void client_route_destroy(client_route_t* self)
+{
+    direct_client_destroy(&self->direct);
+    free(self->items);
+}
+
+void client_route_send(client_route_t* self, const char* task_id)
+{
+    void* socket = self->direct
+        ? direct_client_pick(self->direct, zclock_time(), 0) : self->frontend;
+    if (self->dealer)
+        zstr_sendm(socket, "");
+    zstr_send(socket, task_id);
+}
+
+// Wait at most timeout msecs for a reply; returns it past the delimiter,
+// and the index of the frontend it came from, 0 for our broker's; or null if
+// none came, or if interrupted
+zmsg_t* client_route_recv(client_route_t* self, int timeout, int* from,
+        bool* interrupted)
+{
+    *interrupted = false;
+    if (zmq_poll(self->items, self->nbr_items, timeout * ZMQ_POLL_MSEC)
+            == -1) {
+        *interrupted = true;
+        return 0;
+    }
+    for (int i = 0; i < self->nbr_items; ++i) {
+        if (!(self->items[i].revents & ZMQ_POLLIN))
+            continue;
+        zmsg_t* reply = zmsg_recv(self->items[i].socket);
+        if (!reply) {
+            *interrupted = true;
+            return 0;
+        }
+        if (self->dealer)
+            free(zmsg_popstr(reply));   // Empty delimiter
+        *from = i;
+        return reply;
+    }
+    return 0;
+}
+
+// Take the path of a task from its reply, which came from frontend from;
+// tasks sent straight to a peer went direct whatever that peer did with them
+void s_metrics_reply(zmsg_t* reply, int from, metrics_t* metrics)
+{
+    s_metrics_stamps(reply, metrics);
+    if (from != 0)
+        metrics->path = METRICS_DIRECT;
+}
+
+// The open loop client sends tasks at the configured rate, whether replies
+// come or not, over DEALER sockets so that many can be outstanding; see
+// loadgen.h. Tasks are meant to go out on schedule, so latency counts from
+// then. Tasks without a reply in ten seconds are lost
+void s_client_open_loop(const broker_config_t* config, client_route_t* route,
+        void* monitor)
+{
+    loadgen_t* gen = (loadgen_t*)malloc(sizeof(loadgen_t));
+    assert(gen);
+    loadgen_init(gen, config->rate, config->arrivals, CLIENT_OUTSTANDING,
+            zclock_usecs(), (uint64_t)zthread_id());
+    metrics_t metrics;
+    uint32_t id;
+    while (!s_stopped(config)) {
+        int64_t now = zclock_usecs();
+        while (loadgen_send(gen, now, &id, &metrics.enqueued_at)) {
+            snprintf(metrics.task_id, sizeof(metrics.task_id), "%.20s-%08x",
+                    config->self, id);
+            client_route_send(route, metrics.task_id);
+        }
+        while (loadgen_expire(gen, now - CLIENT_TIMEOUT * 1000, &id,
+                    &metrics.enqueued_at)) {
+            snprintf(metrics.task_id, sizeof(metrics.task_id), "%.20s-%08x",
+                    config->self, id);
+            metrics.dequeued_at = 0;
+            metrics.completed_at = now;
+            metrics.path = METRICS_LOST;
+            s_metrics_send(monitor, &metrics);
+        }
+
+        // Wake up for the next task, and now and then to expire tasks and
+        // check for stop
+        int timeout = loadgen_wait(gen, zclock_usecs());
+        if (timeout < 0 || timeout > STOP_CHECK)
+            timeout = STOP_CHECK;
+        int from;
+        bool interrupted;
+        zmsg_t* reply = client_route_recv(route, timeout, &from,
+                &interrupted);
+        if (interrupted)
+            break;
+        if (!reply)
+            continue;
+        metrics.completed_at = zclock_usecs();
+        char* task_id = zmsg_popstr(reply);
+        const char* hex = task_id ? strrchr(task_id, '-') : 0;
+        int64_t intended_at = hex
+            ? loadgen_done(gen, (uint32_t)strtoul(hex + 1, 0, 16)) : -1;
+        if (intended_at != -1) {
+            snprintf(metrics.task_id, sizeof(metrics.task_id), "%s", task_id);
+            metrics.enqueued_at = intended_at;
+            s_metrics_reply(reply, from, &metrics);
+            s_metrics_send(monitor, &metrics);
+        }
+        free(task_id);
+        zmsg_destroy(&reply);
+    }
+    free(gen);
+}
+
+// This is the client task. It issues a burst of requests and sleeps for a few
+// seconds. This simulates sporadic activity: when a number of clients are
+// active at once, local workers should be overloaded. The client uses a REQ
+// socket for requests and also pushes metrics of each task to the monitor
+// socket, see metrics.h. With a rate configured, the client sends open loop
+// instead; with direct routing, it sends tasks to any broker
+void* client_task(void* arg)
+{
+    const broker_config_t* config = (const broker_config_t*)arg;
+    srand(zthread_id());
+
+    zctx_t* ctx = s_ctx_new(config);
+    client_route_t route;
+    client_route_init(&route, ctx, config, config->rate > 0);
+    char endpoint[256];
+    void* monitor = zsocket_new(ctx, ZMQ_PUSH);
+    zsocket_connect(monitor, monitor_endpoint(config->self, endpoint));
+    if (config->rate > 0) {
+        s_client_open_loop(config, &route, monitor);
+        client_route_destroy(&route);
+        zctx_destroy(&ctx);
+        return 0;
+    }
+
+    while (!s_stopped(config)) {
+        if (config->burst_interval)
+            zclock_sleep(randof(config->burst_interval));
+        int burst = randof(config->burst_max);
+        while (burst-- && !s_stopped(config)) {
+            metrics_t metrics;
+            snprintf(metrics.task_id, sizeof(metrics.task_id), "%s-%04x",
+                    config->self, randof(0x10000));
+            // Send request with random hex ID
+            metrics.enqueued_at = zclock_usecs();
+            client_route_send(&route, metrics.task_id);
+            // Wait at most ten seconds for reply, then complain
+            int from;
+            bool interrupted;
+            zmsg_t* reply = client_route_recv(&route, CLIENT_TIMEOUT, &from,
+                    &interrupted);
+            if (interrupted)
+                break;
+            if (reply) {
+                metrics.completed_at = zclock_usecs();
+                // Worker is supposed to answer the client with task id
+                char* task_id = zmsg_popstr(reply);
+                assert(streq(task_id, metrics.task_id));
+                free(task_id);
+                s_metrics_reply(reply, from, &metrics);
+                zmsg_destroy(&reply);
+                s_metrics_send(monitor, &metrics);
+            } else {
+                metrics.dequeued_at = 0;
+                metrics.completed_at = zclock_usecs();
+                metrics.path = METRICS_LOST;
+                s_metrics_send(monitor, &metrics);
+                client_route_destroy(&route);
+                zctx_destroy(&ctx);
+                return 0;
+            }
+        }
+    }
+
+    client_route_destroy(&route);
+    zctx_destroy(&ctx);
+    return 0;
+}
+
+// This is the worker task, which uses a REQ socket to plug into the
+// load-balancer.
+void* worker_task(void* arg)
+{
+    const broker_config_t* config = (const broker_config_t*)arg;
+    srand(zthread_id());
+
+    zctx_t* ctx = s_ctx_new(config);
+    char endpoint[256];
+    void* worker = zsocket_new(ctx, ZMQ_REQ);
+    zsocket_connect(worker, localbe_endpoint(config->self, endpoint));
+    // Tell the broker that we're ready before serving any requests
+    zframe_t* frame = zframe_new(WORKER_READY, 1);
+    zframe_send(&frame, worker, 0);
+    // Handle requests
+    while (!s_stopped(config)) {
+        zmq_pollitem_t items[] = { { worker, 0, ZMQ_POLLIN, 0 } };
+        int rc = zmq_poll(items, 1,
+                config->stop ? STOP_CHECK * ZMQ_POLL_MSEC : -1);
+        if (rc == -1)
+            break;  // Interrupted
+        if (!(items[0].revents & ZMQ_POLLIN))
+            continue;
+        zmsg_t* msg = zmsg_recv(worker);
+        if (!msg)
+            break;  // Interrupted
+        // Sleep for 0 or 1 service time, to simulate the real request
+        // handling procedure
+        if (config->verbose) {
+            // The task id follows the envelope of the last hop, and the
+            // stamps of routers follow it
+            zframe_t* task_frame = zmsg_first(msg);
+            bool after_envelope = false;
+            for (zframe_t* frame = task_frame; frame;
+                    frame = zmsg_next(msg)) {
+                if (after_envelope)
+                    task_frame = frame;
+                after_envelope = zframe_size(frame) == 0;
+            }
+            char* task = zframe_strdup(task_frame);
+            fprintf(config->log, "processing task %s\n", task);
+            free(task);
+        }
+        zclock_sleep(randof(2) * config->service_time);
+        zmsg_send(&msg, worker);
+    }
+    zctx_destroy(&ctx);
+    return 0;
+}
+
+// The router routes tasks and replies. The local frontend talks to clients,
+// and the local backend talks to workers. The cloud frontend talks to other
+// peer brokers as if they were clients, and the cloud backend talks to peer
+// brokers as if they were workers.
+struct router_t {
+    const broker_config_t* config;
+    broker_stats_t* stats;
+    void* localfe;
+    void* localbe;
+    void* cloudfe;
+    void* cloudbe;
+    void* pipe;             // To state flow in a threaded broker, or null
+    peers_t* peers;         // Spare capacity of each peer, as last reported
+    int local_capacity;
+    worker_queue_t available_workers;
+    zlist_t* held;          // Task from a peer we can't serve or pass on
+                            // yet, at most one
+};
+
+router_t* router_new(zctx_t* ctx, const broker_config_t* config,
+        broker_stats_t* stats, void* pipe)
+{
+    router_t* self = (router_t*)calloc(1, sizeof(router_t));
+    assert(self);
+    self->config = config;
+    self->stats = stats;
+    self->pipe = pipe;
+    char endpoint[256];
+    // Prepare local frontend and backend
+    self->localfe = zsocket_new(ctx, ZMQ_ROUTER);
+    zsocket_bind(self->localfe, localfe_endpoint(config->self, endpoint));
+    self->localbe = zsocket_new(ctx, ZMQ_ROUTER);
+    zsocket_bind(self->localbe, localbe_endpoint(config->self, endpoint));
+    // Bind cloud frontend to endpoint; the state flow attaches the cloud
+    // backend to peers
+    self->cloudfe = zsocket_new(ctx, ZMQ_ROUTER);
+    zsocket_set_identity(self->cloudfe, (char*)config->self);
+    zsocket_bind(self->cloudfe, cloud_endpoint(config->self, endpoint));
+    self->cloudbe = zsocket_new(ctx, ZMQ_ROUTER);
+    zsocket_set_identity(self->cloudbe, (char*)config->self);
+
+    self->peers = peers_new();
+    self->available_workers.pool = slab_new(sizeof(worker_node_t), 64);
+    self->held = zlist_new();
+    return self;
+}
+
+void router_destroy(router_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        router_t* self = *self_p;
+        zframe_t* frame;
+        while ((frame = worker_queue_pop(&self->available_workers)))
+            zframe_destroy(&frame);
+        if (self->config->verbose)
+            fprintf(self->config->log,
+                    "I: worker queue took %d nodes from %d slabs\n",
+                    (int)self->available_workers.pool->allocs,
+                    (int)self->available_workers.pool->heap_allocs);
+        slab_destroy(&self->available_workers.pool);
+        while (zlist_size(self->held)) {
+            zmsg_t* msg = (zmsg_t*)zlist_pop(self->held);
+            zmsg_destroy(&msg);
+        }
+        zlist_destroy(&self->held);
+        peers_destroy(&self->peers);
+        free(self);
+        *self_p = 0;
+    }
+}
+
+// Connect the cloud backend to a peer
+void router_attach(router_t* self, const char* peer)
+{
+    char endpoint[256];
+    zsocket_connect(self->cloudbe, cloud_endpoint(peer, endpoint));
+    if (self->pipe)
+        peers_add(self->peers, peer);
+}
+
+void router_detach(router_t* self, const char* peer)
+{
+    char endpoint[256];
+    zsocket_disconnect(self->cloudbe, cloud_endpoint(peer, endpoint));
+    if (self->pipe)
+        peers_remove(self->peers, peer);
+}
+
+// Handle replies from workers and peers, items are those of the local and
+// cloud backends; returns false if interrupted
+bool router_recv_backends(router_t* self, zmq_pollitem_t* items)
+{
+    zmsg_t* msg = 0;
+    // Reply from local worker
+    if (items[0].revents & ZMQ_POLLIN) {
+        msg = zmsg_recv(self->localbe);
+        if (!msg)
+            return false;  // Interrupted
+        zframe_t* identity = zmsg_unwrap(msg);
+        // The worker must be available after this reply, so add it to
+        // the available worker list
+        worker_queue_push(&self->available_workers, identity);
+        self->local_capacity++;
+
+        // Do not route the message further if it's READY message,
+        // by destroying it
+        zframe_t* frame = zmsg_first(msg);
+        if (!memcmp(zframe_data(frame), WORKER_READY, 1)) {
+            zmsg_destroy(&msg);
+        }
+    }
+    // Reply from peer broker
+    else if (items[1].revents & ZMQ_POLLIN) {
+        msg = zmsg_recv(self->cloudbe);
+        if (!msg)
+            return false;  // Interrupted
+        // Remove the identity frame added by cloud backend, to route
+        // the message back to client frontend
+        zframe_t* identity = zmsg_unwrap(msg);
+        zframe_destroy(&identity);
+    }
+    // Route reply to cloud if it's addressed to a peer broker
+    if (msg && peers_lookup(self->peers, zframe_data(zmsg_first(msg)),
+                zframe_size(zmsg_first(msg))))
+        zmsg_send(&msg, self->cloudfe);
+    // Route reply to client if still need to
+    if (msg)
+        zmsg_send(&msg, self->localfe);
+    return true;
+}
+
+// Stamp a task with the time and the path it takes, for the metrics of its
+// client
+void s_stamp(zmsg_t* msg, metrics_path_t path)
+{
+    unsigned char stamp[METRICS_STAMP_SIZE];
+    metrics_stamp_encode(stamp, zclock_usecs(), path);
+    zmsg_addmem(msg, stamp, METRICS_STAMP_SIZE);
+}
+
+// The hops frame of a task from a peer, see hops.h, which is directly after
+// the delimiter, the last empty frame, as envelopes grow in front with each
+// hop; null if there's no frame after it
+zframe_t* s_hops_frame(zmsg_t* msg)
+{
+    zframe_t* found = 0;
+    bool after_delimiter = false;
+    for (zframe_t* frame = zmsg_first(msg); frame; frame = zmsg_next(msg)) {
+        if (after_delimiter)
+            found = frame;
+        after_delimiter = zframe_size(frame) == 0;
+    }
+    return found;
+}
+
+// Route a task to a local worker; tasks from peers leave their hops here
+void router_to_worker(router_t* self, zmsg_t** msg_p, bool from_cloud)
+{
+    if (from_cloud) {
+        zframe_t* hops = s_hops_frame(*msg_p);
+        if (hops) {
+            zmsg_remove(*msg_p, hops);
+            zframe_destroy(&hops);
+        }
+    }
+    zframe_t* worker = worker_queue_pop(&self->available_workers);
+    self->local_capacity--;
+    s_stamp(*msg_p, METRICS_LOCAL);
+    zmsg_wrap(*msg_p, worker);
+    zmsg_send(msg_p, self->localbe);
+    if (from_cloud)
+        self->stats->from_cloud++;
+    else
+        self->stats->local++;
+}
+
+// Pass a task from a peer on to one of our peers with spare capacity, which
+// the task didn't go through yet; returns false if it has no hops left, or
+// there's no such peer, and the task stays ours
+bool router_forward(router_t* self, zmsg_t** msg_p)
+{
+    hops_t hops;
+    zframe_t* frame = s_hops_frame(*msg_p);
+    if (!frame || !hops_decode(zframe_data(frame), zframe_size(frame), &hops)
+            || !hops_visit(&hops, self->config->self))
+        return false;
+    uint64_t now = zclock_time();
+    peer_t* peer = peers_select(self->peers, now, self->config->policy,
+            hops.names, hops.nbr_visited);
+    if (!peer)
+        return false;
+    unsigned char data[HOPS_MSG_MAX];
+    zframe_reset(frame, data, hops_encode(data, &hops));
+    s_stamp(*msg_p, METRICS_CLOUD);
+    zmsg_pushmem(*msg_p, peer->name, peer->name_size);
+    zmsg_send(msg_p, self->cloudbe);
+    peers_routed(self->peers, peer, now);
+    self->stats->forwarded++;
+    return true;
+}
+
+// Now route as many clients requests as we can handle. If we have local
+// capacity, then poll both localfe and cloudfe, 'cause requests from cloudfe
+// should only be routed to local workers, unless they may go through more
+// peers. If we have cloud capacity only, then poll just localfe. Route
+// requests locally if possible, otherwise, route to a peer which recently
+// reported spare capacity. Either way, stamp the task with the time and
+// path, for the metrics of its client.
+// Requests from cloudfe which we can neither serve nor pass on are held
+// until we can, and go first; we don't take more from cloudfe meanwhile, so
+// those wait in the queues of the peers, and are dropped there past the
+// high-water mark, rather than piling up here.
+void router_route(router_t* self)
+{
+    const broker_config_t* config = self->config;
+    bool forwarding = config->max_hops > 1;
+    while (zlist_size(self->held)) {
+        zmsg_t* msg = (zmsg_t*)zlist_pop(self->held);
+        if (self->local_capacity) {
+            router_to_worker(self, &msg, true);
+        } else if (!router_forward(self, &msg)) {
+            zlist_push(self->held, msg);
+            break;
+        }
+    }
+
+    while (true) {
+        // Pick the peer for a client task before reading one, with a single
+        // reading of the clock, so there's one whenever we take a task our
+        // workers can't
+        uint64_t now = zclock_time();
+        peer_t* peer = self->local_capacity
+            ? 0 : peers_select(self->peers, now, config->policy);
+        if (!self->local_capacity && !peer)
+            break;
+        zmq_pollitem_t secondary[] = {
+            { self->localfe, 0, ZMQ_POLLIN, 0 },
+            { self->cloudfe, 0, ZMQ_POLLIN, 0 }
+        };
+        bool take_cloud = (self->local_capacity || forwarding)
+            && zlist_size(self->held) == 0;
+        int rc = zmq_poll(secondary, take_cloud ? 2 : 1, 0);
+        assert(rc >= 0);
+
+        zmsg_t* msg = 0;
+        bool from_cloud = false;
+        if (secondary[0].revents & ZMQ_POLLIN) {
+            msg = zmsg_recv(self->localfe);
+        } else if (secondary[1].revents & ZMQ_POLLIN) {
+            msg = zmsg_recv(self->cloudfe);
+            from_cloud = true;
+        } else {
+            break;  // No work, go back to primary
+        }
+        if (!msg)
+            break;  // Interrupted
+
+        if (self->local_capacity) {
+            router_to_worker(self, &msg, from_cloud);
+        } else if (from_cloud) {
+            if (!router_forward(self, &msg))
+                zlist_append(self->held, msg);
+        } else {
+            // Route to the peer with spare capacity picked by policy, and
+            // count the task against it until the peer reports again. The
+            // task may go through more peers if it can't be served there
+            s_stamp(msg, METRICS_CLOUD);
+            // All tasks to peers have hops, directly after the delimiter,
+            // as the client's envelope is its identity alone
+            hops_t hops;
+            hops_init(&hops, config->self, config->max_hops);
+            unsigned char data[HOPS_MSG_MAX];
+            zframe_t* client = zmsg_unwrap(msg);
+            zmsg_pushmem(msg, data, hops_encode(data, &hops));
+            zmsg_wrap(msg, client);
+            zmsg_pushmem(msg, peer->name, peer->name_size);
+            zmsg_send(&msg, self->cloudbe);
+            peers_routed(self->peers, peer, now);
+            self->stats->cloud++;
+        }
+    }
+}
+
+// Handle a command from the state flow; returns false if interrupted
+bool router_recv_pipe(router_t* self)
+{
+    char command;
+    int value;
+    char peer[PEER_NAME_MAX + 1];
+    if (!s_pipe_recv(self->pipe, &command, &value, peer))
+        return false;
+    if (command == PIPE_UPDATE)
+        peers_update(self->peers, peer, value, zclock_time());
+    else if (command == PIPE_ATTACH)
+        router_attach(self, peer);
+    else if (command == PIPE_DETACH)
+        router_detach(self, peer);
+    return true;
+}
+
+// A peer of our view, which we gossip to
+struct view_peer_t {
+    void* socket;
+    char name[PEER_NAME_MAX + 1];
+};
+
+// The state flow tells peers about our capacity, and learns theirs. The
+// state backend publishes regular state messages, and the state frontend
+// subscribes to all other state backends to collect these messages. In gossip
+// mode, the state frontend pulls gossip instead, and the state backend is a
+// few PUSH sockets to the peers of our view. Peers given in the config stay,
+// others come and go as we hear their beacons.
+// In a threaded broker, the state flow keeps its own table of peers, and
+// tells the router about reports and peers over a pipe; otherwise, it shares
+// the table with the router, and attaches peers to it directly.
+struct state_flow_t {
+    zctx_t* ctx;
+    const broker_config_t* config;
+    broker_stats_t* stats;
+    void* statebe;
+    void* statefe;
+    view_peer_t view[GOSSIP_VIEW_MAX];
+    int view_size;
+    beacon_t* beacon;
+    uint64_t beacon_at;     // Next hello at this time
+    router_t* router;       // Router in the same thread, or null
+    void* pipe;             // To router in a threaded broker, or null
+    peers_t* peers;
+    state_reporter_t reporter;  // When to tell peers about our capacity
+    uint64_t version;       // Of our report, for gossip, see gossip.h
+    uint64_t gossip_at;     // Next gossip round at this time
+    int gossip_max;         // Entries a gossip message can take
+    unsigned char* gossip;
+};
+
+// Add a peer to our view. An old vector is worth nothing once the next one
+// is due, so don't queue them
+void s_gossip_to(state_flow_t* self, const char* peer)
+{
+    char endpoint[256];
+    if (self->config->verbose)
+        fprintf(self->config->log, "I: gossiping to '%s'...\n", peer);
+    view_peer_t* view_peer = &self->view[self->view_size++];
+    view_peer->socket = zsocket_new(self->ctx, ZMQ_PUSH);
+    zsocket_set_sndhwm(view_peer->socket, 1);
+    zsocket_set_linger(view_peer->socket, 0);
+    zsocket_connect(view_peer->socket, gossip_endpoint(peer, endpoint));
+    strcpy(view_peer->name, peer);
+}
+
+// Connect to a peer, one of that many; in gossip mode, it joins our view if
+// that's not full for so many peers
+void s_attach(state_flow_t* self, const char* peer, int nbr_peers)
+{
+    const broker_config_t* config = self->config;
+    char endpoint[256];
+    if (config->verbose)
+        fprintf(config->log, "I: connecting to '%s'...\n", peer);
+    if (self->pipe)
+        s_pipe_send(self->pipe, PIPE_ATTACH, 0, peer);
+    else
+        router_attach(self->router, peer);
+    if (!config->gossip)
+        zsocket_connect(self->statefe, state_endpoint(peer, endpoint));
+    else if (self->view_size < gossip_view_size(nbr_peers))
+        s_gossip_to(self, peer);
+}
+
+// Disconnect from a peer which is gone; in gossip mode, another one of the
+// remaining peers takes its place in our view
+void s_detach(state_flow_t* self, const char* peer)
+{
+    const broker_config_t* config = self->config;
+    char endpoint[256];
+    if (config->verbose)
+        fprintf(config->log, "I: disconnecting from '%s'...\n", peer);
+    if (self->pipe)
+        s_pipe_send(self->pipe, PIPE_DETACH, 0, peer);
+    else
+        router_detach(self->router, peer);
+    if (!config->gossip) {
+        zsocket_disconnect(self->statefe, state_endpoint(peer, endpoint));
+        return;
+    }
+    int i = 0;
+    while (i < self->view_size && !streq(self->view[i].name, peer))
+        i++;
+    if (i == self->view_size)
+        return;
+    zsocket_destroy(self->ctx, self->view[i].socket);
+    self->view[i] = self->view[--self->view_size];
+    peers_t* peers = self->peers;
+    for (int tries = 0; tries < peers->size; ++tries) {
+        const char* other = peers->items[randof(peers->size)].name;
+        bool in_view = streq(other, peer);
+        for (int j = 0; j < self->view_size && !in_view; ++j)
+            in_view = streq(self->view[j].name, other);
+        if (!in_view) {
+            s_gossip_to(self, other);
+            break;
+        }
+    }
+}
+
+// Start the state flow, for a router in the same thread, or one at the other
+// end of the pipe
+state_flow_t* state_flow_new(zctx_t* ctx, const broker_config_t* config,
+        broker_stats_t* stats, router_t* router, void* pipe)
+{
+    assert(router || pipe);
+    state_flow_t* self = (state_flow_t*)calloc(1, sizeof(state_flow_t));
+    assert(self);
+    self->ctx = ctx;
+    self->config = config;
+    self->stats = stats;
+    self->router = router;
+    self->pipe = pipe;
+    self->peers = router ? router->peers : peers_new();
+    state_reporter_init(&self->reporter);
+    // Peers drop reports no newer than the last they have of us, which may
+    // be from before a restart; so count from the time, in usecs, as we
+    // report far less often than once per usec
+    self->version = (uint64_t)zclock_time() * 1000;
+
+    char endpoint[256];
+    if (!config->gossip) {
+        // Bind state backend to endpoint
+        self->statebe = zsocket_new(ctx, ZMQ_PUB);
+        zsocket_bind(self->statebe, state_endpoint(config->self, endpoint));
+        self->statefe = zsocket_new(ctx, ZMQ_SUB);
+        zsocket_set_subscribe(self->statefe, (char*)"");
+    } else {
+        // Bind gossip frontend to endpoint
+        self->statefe = zsocket_new(ctx, ZMQ_PULL);
+        zsocket_bind(self->statefe, gossip_endpoint(config->self, endpoint));
+    }
+
+    // Attach all peers, in random order, so that in gossip mode our view is
+    // a random one
+    for (int i = 0; i < config->nbr_peers; ++i)
+        peers_add(self->peers, config->peers[i]);
+    int* order = (int*)malloc(config->nbr_peers * sizeof(int));
+    for (int i = 0; i < config->nbr_peers; ++i)
+        order[i] = i;
+    for (int i = 0; i < config->nbr_peers; ++i) {
+        int j = i + randof(config->nbr_peers - i);
+        int peer = order[j];
+        order[j] = order[i];
+        s_attach(self, config->peers[peer], config->nbr_peers);
+    }
+    free(order);
+
+    // Listen to beacons of other brokers
+    if (config->beacon_port) {
+        self->beacon = beacon_new(config->beacon_port,
+                config->beacon_loopback);
+        if (!self->beacon)
+            fprintf(config->log, "E: can't listen to beacons on port %d\n",
+                    config->beacon_port);
+    }
+    return self;
+}
+
+void state_flow_destroy(state_flow_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        state_flow_t* self = *self_p;
+        if (self->beacon)
+            beacon_send(self->beacon, self->config->self, false);
+        beacon_destroy(&self->beacon);
+        if (!self->router)
+            peers_destroy(&self->peers);
+        free(self->gossip);
+        free(self);
+        *self_p = 0;
+    }
+}
+
+// msecs until the state flow has something to do, for a local capacity
+int state_flow_wait(state_flow_t* self, int local_capacity, uint64_t now)
+{
+    int wait = state_reporter_wait(&self->reporter, local_capacity, now);
+    if (self->config->gossip && self->gossip_at > now
+            && self->gossip_at - now < (uint64_t)wait)
+        wait = (int)(self->gossip_at - now);
+    if (self->beacon && self->beacon_at > now
+            && self->beacon_at - now < (uint64_t)wait)
+        wait = (int)(self->beacon_at - now);
+    return wait;
+}
+
+// Handle a state message; returns false if interrupted
+bool state_flow_recv(state_flow_t* self)
+{
+    zframe_t* state = zframe_recv(self->statefe);
+    if (!state)
+        return false;  // Interrupted
+    uint64_t now = zclock_time();
+    char peer[PEER_NAME_MAX + 1];
+    int capacity;
+    if (self->config->gossip) {
+        if (gossip_merge(self->peers, self->config->self, zframe_data(state),
+                    zframe_size(state), now) > 0 && self->pipe) {
+            // Reports taken now are the ones this message brought
+            for (int i = 0; i < self->peers->size; ++i) {
+                peer_t* peer = &self->peers->items[i];
+                if (peer->updated_at == now)
+                    s_pipe_send(self->pipe, PIPE_UPDATE, peer->capacity,
+                            peer->name);
+            }
+        }
+    } else if (state_decode(zframe_data(state), zframe_size(state), peer,
+                &capacity)) {
+        if (peers_update(self->peers, peer, capacity, now) && self->pipe)
+            s_pipe_send(self->pipe, PIPE_UPDATE, capacity, peer);
+    }
+    zframe_destroy(&state);
+    return true;
+}
+
+// Attach peers which say hello for the first time, and detach those which
+// say bye; peers given in the config stay in any case
+void state_flow_recv_beacon(state_flow_t* self)
+{
+    char name[PEER_NAME_MAX + 1];
+    bool hello;
+    if (!beacon_recv(self->beacon, name, &hello)
+            || streq(name, self->config->self))
+        return;
+    peer_t* peer = peers_lookup(self->peers, name, strlen(name));
+    if (hello && !peer) {
+        if (self->config->verbose)
+            fprintf(self->config->log, "I: discovered peer '%s'\n", name);
+        peer = peers_add(self->peers, name);
+        peer->heard_at = zclock_time();
+        s_attach(self, name, self->peers->size);
+    } else if (hello && peer->heard_at) {
+        peer->heard_at = zclock_time();
+    } else if (!hello && peer && peer->heard_at) {
+        s_detach(self, name);
+        peers_remove(self->peers, name);
+    }
+}
+
+// Report our capacity, gossip and say hello when it's time to
+void state_flow_tick(state_flow_t* self, int local_capacity, uint64_t now)
+{
+    const broker_config_t* config = self->config;
+    broker_stats_t* stats = self->stats;
+    peers_t* peers = self->peers;
+
+    // Broadcast our capacity to other peers when the reporter says so,
+    // with our own identity stuck to it. In gossip mode, a report is a
+    // new version of our entry, and goes out with the next round, which
+    // is now
+    bool due = state_reporter_due(&self->reporter, local_capacity, now);
+    if (due && !config->gossip) {
+        unsigned char state[STATE_MSG_MAX];
+        size_t size = state_encode(state, config->self, local_capacity);
+        zmq_send(self->statebe, state, size, 0);
+        stats->state_messages += peers->size;
+    }
+    if (due && config->gossip)
+        self->version++;
+    if (config->gossip && self->view_size
+            && (due || now >= self->gossip_at)) {
+        self->gossip_at = now + GOSSIP_INTERVAL;
+        if (peers->size + 1 > self->gossip_max) {
+            self->gossip_max = peers->max_size + 1;
+            self->gossip = (unsigned char*)realloc(self->gossip,
+                    self->gossip_max * GOSSIP_ENTRY_MAX);
+            assert(self->gossip);
+        }
+        size_t size = gossip_encode(self->gossip, config->self,
+                self->reporter.reported, self->version, peers, now);
+        for (int i = 0; i < GOSSIP_FANOUT && i < self->view_size; ++i) {
+            // Fanout distinct peers of the view at random
+            int j = i + randof(self->view_size - i);
+            view_peer_t peer = self->view[j];
+            self->view[j] = self->view[i];
+            self->view[i] = peer;
+            if (zmq_send(peer.socket, self->gossip, size, ZMQ_DONTWAIT) != -1)
+                stats->state_messages++;
+        }
+    }
+
+    // Say hello to other brokers now and then, and forget discovered
+    // peers which didn't for a while
+    if (self->beacon && now >= self->beacon_at) {
+        self->beacon_at = now + BEACON_INTERVAL;
+        beacon_send(self->beacon, config->self, true);
+        int i = 0;
+        while (i < peers->size) {
+            peer_t* peer = &peers->items[i];
+            if (peer->heard_at && now > peer->heard_at + BEACON_TTL) {
+                char name[PEER_NAME_MAX + 1];
+                strcpy(name, peer->name);
+                s_detach(self, name);
+                peers_remove(peers, name);  // Last peer moves to i
+            } else {
+                i++;
+            }
+        }
+    }
+    stats->state_changes = self->reporter.changes;
+    stats->state_reports = self->reporter.reports;
+}
+
+// The monitor collects the metrics of tasks from clients, over a PULL socket,
+// and prints a summary of each second
+struct monitor_t {
+    const broker_config_t* config;
+    broker_stats_t* stats;
+    void* monitor;
+    metrics_agg_t* agg;
+    int64_t second;         // Last second summarized
+};
+
+monitor_t* monitor_new(zctx_t* ctx, const broker_config_t* config,
+        broker_stats_t* stats)
+{
+    monitor_t* self = (monitor_t*)calloc(1, sizeof(monitor_t));
+    assert(self);
+    self->config = config;
+    self->stats = stats;
+    char endpoint[256];
+    self->monitor = zsocket_new(ctx, ZMQ_PULL);
+    zsocket_bind(self->monitor, monitor_endpoint(config->self, endpoint));
+    self->agg = metrics_agg_new();
+    self->second = zclock_usecs() / 1000000;
+    return self;
+}
+
+void monitor_destroy(monitor_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        monitor_t* self = *self_p;
+        metrics_agg_destroy(&self->agg);
+        free(self);
+        *self_p = 0;
+    }
+}
+
+// Handle metrics from a client; returns false if interrupted. Once metrics
+// of a later second come, print a summary of the last second and of the
+// window, rather than waking up every second
+bool monitor_recv(monitor_t* self)
+{
+    unsigned char data[METRICS_MSG_SIZE + 1];
+    int size = zmq_recv(self->monitor, data, sizeof(data), 0);
+    if (size == -1)
+        return false;  // Interrupted
+    metrics_t metrics;
+    if (!metrics_decode(data, size, &metrics))
+        return true;
+    broker_stats_t* stats = self->stats;
+    if (metrics.path == METRICS_LOST) {
+        stats->lost++;
+    } else {
+        if (metrics.path == METRICS_DIRECT)
+            stats->direct++;
+        stats->latencies[stats->replies % BROKER_LATENCIES] =
+            metrics.completed_at - metrics.enqueued_at;
+        stats->replies++;
+    }
+    metrics_agg_add(self->agg, &metrics);
+
+    int64_t now = zclock_usecs();
+    if (self->config->verbose && now / 1000000 > self->second) {
+        self->second = now / 1000000;
+        metrics_report_t last, window;
+        metrics_agg_report(self->agg, now, 1, &last);
+        metrics_agg_report(self->agg, now, METRICS_WINDOW, &window);
+        fprintf(self->config->log, "M: %s %.0f tasks/s, %.0f%% cloud, "
+                "%.0f%% direct, p50/p95/p99 %.1f/%.1f/%.1fms, wait p50 %.1fms, "
+                "%d lost; last %ds %.1f tasks/s, p99 %.1fms\n",
+                self->config->self, last.throughput, 100 * last.cloud,
+                100 * last.direct, last.latency_p50 / 1000.0,
+                last.latency_p95 / 1000.0, last.latency_p99 / 1000.0,
+                last.wait_p50 / 1000.0, last.lost, window.seconds,
+                window.throughput, window.latency_p99 / 1000.0);
+    }
+    return true;
+}
+
+struct thread_args_t {
+    const broker_config_t* config;
+    broker_stats_t* stats;
+};
+
+// State flow thread of a threaded broker
+void state_flow_thread(void* arg, zctx_t* ctx, void* pipe)
+{
+    thread_args_t* args = (thread_args_t*)arg;
+    const broker_config_t* config = args->config;
+    state_flow_t* self = state_flow_new(ctx, config, args->stats, 0, pipe);
+    int local_capacity = 0;     // As the router last told
+    while (!s_stopped(config)) {
+        zmq_pollitem_t items[] = {
+            { pipe, 0, ZMQ_POLLIN, 0 },
+            { self->statefe, 0, ZMQ_POLLIN, 0 },
+            { 0, self->beacon ? beacon_fd(self->beacon) : 0, ZMQ_POLLIN, 0 }
+        };
+        int timeout = state_flow_wait(self, local_capacity, zclock_time());
+        if (config->stop && timeout > STOP_CHECK)
+            timeout = STOP_CHECK;
+        int rc = zmq_poll(items, self->beacon ? 3 : 2,
+                timeout * ZMQ_POLL_MSEC);
+        if (rc == -1)
+            break;  // Interrupted
+        if (items[0].revents & ZMQ_POLLIN) {
+            char command;
+            int value;
+            char name[PEER_NAME_MAX + 1];
+            if (!s_pipe_recv(pipe, &command, &value, name)
+                    || command == PIPE_TERM)
+                break;
+            if (command == PIPE_CAPACITY)
+                local_capacity = value;
+        }
+        if ((items[1].revents & ZMQ_POLLIN) && !state_flow_recv(self))
+            break;  // Interrupted
+        if (self->beacon && (items[2].revents & ZMQ_POLLIN))
+            state_flow_recv_beacon(self);
+        state_flow_tick(self, local_capacity, zclock_time());
+    }
+    state_flow_destroy(&self);
+    s_pipe_send(pipe, PIPE_TERM, 0, "");
+}
+
+// Monitor thread of a threaded broker
+void monitor_thread(void* arg, zctx_t* ctx, void* pipe)
+{
+    thread_args_t* args = (thread_args_t*)arg;
+    monitor_t* self = monitor_new(ctx, args->config, args->stats);
+    while (true) {
+        zmq_pollitem_t items[] = {
+            { pipe, 0, ZMQ_POLLIN, 0 },
+            { self->monitor, 0, ZMQ_POLLIN, 0 }
+        };
+        if (zmq_poll(items, 2, -1) == -1)
+            break;  // Interrupted
+        if (items[0].revents & ZMQ_POLLIN)
+            break;  // Only command is PIPE_TERM
+        if (!monitor_recv(self))
+            break;  // Interrupted
+    }
+    monitor_destroy(&self);
+    s_pipe_send(pipe, PIPE_TERM, 0, "");
+}
+
+// Tell a thread of a threaded broker to stop, and wait until it has, as it
+// uses the config and the stats of the broker, which go with broker_run
+void s_thread_stop(void* pipe)
+{
+    s_pipe_send(pipe, PIPE_TERM, 0, "");
+    char command;
+    int value;
+    char name[PEER_NAME_MAX + 1];
+    while (s_pipe_recv(pipe, &command, &value, name) && command != PIPE_TERM)
+        ;   // Updates for the router, too late now
+}
+
+void s_start_tasks(const broker_config_t* config)
+{
+    for (int i = 0; i < config->nbr_workers; ++i)
+        zthread_new(worker_task, (void*)config);
+    for (int i = 0; i < config->nbr_clients; ++i)
+        zthread_new(client_task, (void*)config);
+}
+
+// The single loop broker polls workers, peers and our two service sockets
+// (statefe and monitor), in any case. If we have no ready workers, then
+// there's no point in looking at incoming requests.
+void s_run_single(zctx_t* ctx, const broker_config_t* config,
+        broker_stats_t* stats)
+{
+    router_t* router = router_new(ctx, config, stats, 0);
+    state_flow_t* state_flow = state_flow_new(ctx, config, stats, router, 0);
+    monitor_t* monitor = monitor_new(ctx, config, stats);
+    // After binding and connecting all our sockets, start the child tasks -
+    // workers and clients:
+    s_start_tasks(config);
+
+    beacon_t* beacon = state_flow->beacon;
+    while (!s_stopped(config)) {
+        zmq_pollitem_t primary[] = {
+            { router->localbe, 0, ZMQ_POLLIN, 0 },
+            { router->cloudbe, 0, ZMQ_POLLIN, 0 },
+            { state_flow->statefe, 0, ZMQ_POLLIN, 0 },
+            { monitor->monitor, 0, ZMQ_POLLIN, 0 },
+            { 0, beacon ? beacon_fd(beacon) : 0, ZMQ_POLLIN, 0 }
+        };
+        // Wait indefintely if there's no available local workers,
+        // otherwise, block for at most 1 second; but wake up for the state
+        // flow in any case
+        int timeout = router->local_capacity ? 1000 : -1;
+        if (config->stop)
+            timeout = STOP_CHECK;
+        int state_wait = state_flow_wait(state_flow, router->local_capacity,
+                zclock_time());
+        if (timeout < 0 || state_wait < timeout)
+            timeout = state_wait;
+        int rc = zmq_poll(primary, beacon ? 5 : 4, timeout * ZMQ_POLL_MSEC);
+        if (rc == -1)
+            break;  // Interrupted
+
+        if (!router_recv_backends(router, primary))
+            break;  // Interrupted
+        // If we have input messages on statefe or monitor socket, process
+        // them immediately
+        if ((primary[2].revents & ZMQ_POLLIN) && !state_flow_recv(state_flow))
+            break;  // Interrupted
+        if ((primary[3].revents & ZMQ_POLLIN) && !monitor_recv(monitor))
+            break;  // Interrupted
+        if (beacon && (primary[4].revents & ZMQ_POLLIN))
+            state_flow_recv_beacon(state_flow);
+        router_route(router);
+        state_flow_tick(state_flow, router->local_capacity, zclock_time());
+    }
+
+    monitor_destroy(&monitor);
+    state_flow_destroy(&state_flow);
+    router_destroy(&router);
+}
+
+// The threaded broker runs the state flow and the monitor in threads of their
+// own, so that the routing thread only polls workers and peers, and the pipe
+// from the state flow, and never writes to the console
+void s_run_threaded(zctx_t* ctx, const broker_config_t* config,
+        broker_stats_t* stats)
+{
+    thread_args_t args = { config, stats };
+    void* state_pipe = zthread_fork(ctx, state_flow_thread, &args);
+    void* monitor_pipe = zthread_fork(ctx, monitor_thread, &args);
+    router_t* router = router_new(ctx, config, stats, state_pipe);
+    s_start_tasks(config);
+
+    while (!s_stopped(config)) {
+        zmq_pollitem_t primary[] = {
+            { router->localbe, 0, ZMQ_POLLIN, 0 },
+            { router->cloudbe, 0, ZMQ_POLLIN, 0 },
+            { state_pipe, 0, ZMQ_POLLIN, 0 }
+        };
+        int timeout = router->local_capacity ? 1000 : -1;
+        if (config->stop)
+            timeout = STOP_CHECK;
+        int rc = zmq_poll(primary, 3, timeout * ZMQ_POLL_MSEC);
+        if (rc == -1)
+            break;  // Interrupted
+
+        int previous_capacity = router->local_capacity;
+        if (!router_recv_backends(router, primary))
+            break;  // Interrupted
+        if ((primary[2].revents & ZMQ_POLLIN) && !router_recv_pipe(router))
+            break;  // Interrupted
+        router_route(router);
+        if (router->local_capacity != previous_capacity)
+            s_pipe_send(state_pipe, PIPE_CAPACITY, router->local_capacity,
+                    "");
+    }
+
+    s_thread_stop(state_pipe);
+    s_thread_stop(monitor_pipe);
+    router_destroy(&router);
+}
+
+}
+
+void broker_config_init(broker_config_t* config, const char* self,
+        char** peers, int nbr_peers)
+{
+    memset(config, 0, sizeof(broker_config_t));
+    config->self = self;
+    config->peers = peers;
+    config->nbr_peers = nbr_peers;
+    config->nbr_clients = NBR_CLIENTS;
+    config->nbr_workers = NBR_WORKERS;
+    config->burst_interval = 5000;
+    config->burst_max = 15;
+    config->service_time = 1000;
+    config->arrivals = LOADGEN_POISSON;
+    config->max_hops = 1;
+    config->policy = PEER_POLICY_RANDOM;
+    config->verbose = true;
+    config->log = stdout;
+}
+
+// The broker begins by setting up all its sockets, then starts its workers
+// and clients, and routes their tasks, in one loop or in threads
+int broker_run(const broker_config_t* config, broker_stats_t* stats)
+{
+    assert(config);
+    broker_stats_t dummy_stats;
+    if (!stats)
+        stats = &dummy_stats;
+    memset(stats, 0, sizeof(broker_stats_t));
+
+    zctx_t* ctx = s_ctx_new(config);
+    if (config->threaded)
+        s_run_threaded(ctx, config, stats);
+    else
+        s_run_single(ctx, config, stats);
+    zctx_destroy(&ctx);
+    return EXIT_SUCCESS;
+}
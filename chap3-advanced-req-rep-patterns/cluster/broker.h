@@ -0,0 +1,77 @@
+// cluster/broker.h
+//
+// Cluster broker, with its local clients and workers: the full flow of
+// status and tasks, as prototyped by prototype.cpp. Runs one broker per
+// process in prototype.cpp, or several in one process in cluster_bench.cpp.
+// The broker routes tasks, handles state flow and collects statistics in
+// one poll loop, or in three threads connected by inproc pipes, so that
+// state flow and printing don't hold up routing.
+//
+#ifndef CLUSTER_BROKER_H_
+#define CLUSTER_BROKER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "loadgen.h"
+#include "peers.h"
+
+struct broker_config_t {
+    const char* self;           // Name of this broker
+    char** peers;               // Names of peer brokers
+    int nbr_peers;
+    int nbr_clients;
+    int nbr_workers;
+    int burst_interval;         // msecs, clients idle up to this per burst
+    int burst_max;              // Clients send fewer tasks than this per burst
+    int service_time;           // msecs, workers take 0 or this long per task
+    double rate;                // Tasks per second per client, sent open
+                                // loop, see loadgen.h; 0 for bursts
+    loadgen_arrivals_t arrivals;  // Of open loop tasks
+    peer_policy_t policy;       // How to pick a peer with spare capacity
+    int max_hops;               // Peers a task may go through, see hops.h;
+                                // 1 if all brokers connect to each other
+    bool direct;                // Clients send tasks straight to a broker
+                                // with spare capacity, see direct.h
+    bool gossip;                // Spread state by gossip, see gossip.h,
+                                // rather than to all peers
+    int beacon_port;            // Discover peers by beacons on this UDP
+                                // port, see beacon.h, 0 not to
+    bool beacon_loopback;       // Only on this host
+    bool verbose;               // Print tasks and monitor summaries ...
+    FILE* log;                  // ... to this, stdout by default
+    bool threaded;              // Route in a thread of its own, with state
+                                // flow and monitor in others
+    volatile bool* stop;        // Broker and its tasks stop once it's set
+    void* ctx;                  // zctx_t which the broker and its tasks
+                                // shadow, for inproc endpoints, see
+                                // endpoint.h; null for contexts of their own
+};
+
+const int BROKER_LATENCIES = 4096;  // Latencies kept, per broker
+
+// Counters of a broker, written by the broker thread; in a threaded broker,
+// the router writes those of routing, the state flow those of state, and
+// the monitor those of replies, each in its own thread
+struct broker_stats_t {
+    volatile uint64_t local;        // Client tasks served by local workers
+    volatile uint64_t cloud;        // Client tasks routed to peers
+    volatile uint64_t from_cloud;   // Peer tasks served by local workers
+    volatile uint64_t forwarded;    // Peer tasks passed on to other peers
+    volatile uint64_t direct;       // Client tasks sent straight to peers
+    volatile uint64_t replies;      // Replies clients got
+    volatile uint64_t lost;         // Tasks clients gave up on
+    volatile uint64_t state_changes;  // Local capacity changes
+    volatile uint64_t state_reports;  // Reports of them
+    volatile uint64_t state_messages; // State messages sent to peers
+    int64_t latencies[BROKER_LATENCIES];  // usecs, latest replies
+};
+
+// Fill config with the settings of prototype.cpp
+void broker_config_init(broker_config_t* config, const char* self,
+        char** peers, int nbr_peers);
+// Run the broker and start its clients and workers, until interrupted or
+// stopped; stats may be null
+int broker_run(const broker_config_t* config, broker_stats_t* stats);
+
+#endif // CLUSTER_BROKER_H_
@@ -0,0 +1,321 @@
+/**
+ * @file capacity_sim.cpp
+ *
+ * @breif Cloud capacity simulation
+ * Simulates a cluster of brokers like prototype.cpp, in virtual time with
+ * one millisecond ticks, to compare two views of the cloud:
+ *  - last, a single cloud capacity taken from whichever peer reported last,
+ *    and tasks routed to a random peer, as prototype.cpp used to do
+ *  - table, the capacity of each peer with an expiry, see peers.h, and tasks
+ *    routed only to peers with spare capacity, picked by each of the peer
+ *    selection policies in turn
+ * Half of the brokers get more tasks than their workers can take, the others
+ * about a third of what theirs can, so spilling over to the cloud is what
+ * keeps tasks from waiting. A task is bounced when it reaches a peer with no free
+ * worker, and has to wait there.
+ *
+ *   capacity_sim [brokers] [seconds] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peers.h"
+
+namespace {
+
+const int NBR_WORKERS = 5;          // Per broker, as in prototype.cpp
+const int BURST_INTERVAL = 1000;    // msecs, mean time between bursts
+const int BURST_MAX = 15;           // Tasks in a burst, as in prototype.cpp
+const int HOP_DELAY = 1;            // msecs, from broker to peer
+const int STATE_DELAY = 5;          // msecs, for a state message
+const int STATE_INTERVAL = 1000;    // msecs, between unchanged reports
+const int MAX_BROKERS = 64;
+
+enum policy_t { POLICY_LAST, POLICY_TABLE };
+const char* POLICY_NAMES[] = { "last", "table" };
+
+inline int randof(int n) { return rand() % n; }
+
+// FIFO of anything, growing as needed
+struct queue_t {
+    char* items;
+    size_t item_size;
+    size_t head;
+    size_t size;
+    size_t capacity;
+};
+
+void queue_init(queue_t* queue, size_t item_size)
+{
+    memset(queue, 0, sizeof(queue_t));
+    queue->item_size = item_size;
+}
+
+void queue_push(queue_t* queue, const void* item)
+{
+    if (queue->size == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+        char* items = (char*)malloc(capacity * queue->item_size);
+        for (size_t i = 0; i < queue->size; ++i) {
+            size_t index = (queue->head + i) % queue->capacity;
+            memcpy(items + i * queue->item_size,
+                    queue->items + index * queue->item_size,
+                    queue->item_size);
+        }
+        free(queue->items);
+        queue->items = items;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    size_t index = (queue->head + queue->size++) % queue->capacity;
+    memcpy(queue->items + index * queue->item_size, item, queue->item_size);
+}
+
+void* queue_first(queue_t* queue)
+{
+    return queue->size ? queue->items + queue->head * queue->item_size : 0;
+}
+
+void queue_pop(queue_t* queue)
+{
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->size--;
+}
+
+struct task_t {
+    long created;           // Task came from a client at this time
+    long arrive_at;         // Reaches peer at this time, if routed to one
+    int peer;               // Peer it's routed to
+};
+
+struct state_t {
+    long deliver_at;        // Reaches peers at this time
+    int broker;             // Broker reporting ...
+    int capacity;           // ... this capacity
+};
+
+struct broker_t {
+    char name[16];
+    long busy_until[NBR_WORKERS];   // Worker is busy until, 0 when free
+    int capacity;           // Free workers
+    int reported;           // Capacity last broadcast
+    long report_at;         // Next unchanged report at this time
+    long burst_at;          // Next burst of tasks from clients
+    int load;               // Mean interval between bursts, msecs
+    queue_t local;          // Tasks from clients, waiting
+    queue_t cloud;          // Tasks from peers, waiting
+    int cloud_capacity;     // Policy last, capacity of last report
+    peers_t* peers;         // Policy table
+};
+
+struct stats_t {
+    long tasks;
+    long local;             // Served by a local worker
+    long cloud;             // Routed to a peer
+    long bounced;           // Reached a peer with no free worker
+    long state_messages;
+    long started;           // Tasks which got a worker
+    double wait;            // Sum of waits for a worker, msecs
+    long wait_max;
+};
+
+// Start a task on a free worker of the broker
+void s_start(broker_t* broker, const task_t* task, long now, stats_t* stats)
+{
+    for (int i = 0; i < NBR_WORKERS; ++i) {
+        if (broker->busy_until[i] == 0) {
+            // Tasks take 0 or 1 second, as in prototype.cpp
+            broker->busy_until[i] = now + 1 + randof(2) * 1000;
+            broker->capacity--;
+            stats->started++;
+            long wait = now - task->created;
+            stats->wait += wait;
+            if (wait > stats->wait_max)
+                stats->wait_max = wait;
+            return;
+        }
+    }
+    abort();  // Caller checks capacity first
+}
+
+// Pick a peer for a task which can't be served locally, -1 to keep it
+int s_route(broker_t* brokers, int nbr_brokers, int self, policy_t policy,
+        peer_policy_t peer_policy, long now)
+{
+    broker_t* broker = &brokers[self];
+    if (nbr_brokers < 2)
+        return -1;
+    if (policy == POLICY_LAST) {
+        if (broker->cloud_capacity == 0)
+            return -1;
+        int peer = randof(nbr_brokers - 1);
+        return peer < self ? peer : peer + 1;
+    }
+    peer_t* peer = peers_select(broker->peers, now, peer_policy);
+    if (!peer)
+        return -1;
+    peers_routed(broker->peers, peer, (uint64_t)now);
+    return atoi(peer->name + 1);
+}
+
+void s_simulate(int nbr_brokers, int seconds, unsigned int seed,
+        policy_t policy, peer_policy_t peer_policy, stats_t* stats)
+{
+    srand(seed);
+    memset(stats, 0, sizeof(stats_t));
+    broker_t* brokers = (broker_t*)calloc(nbr_brokers, sizeof(broker_t));
+    for (int i = 0; i < nbr_brokers; ++i) {
+        broker_t* broker = &brokers[i];
+        sprintf(broker->name, "b%d", i);
+        broker->capacity = NBR_WORKERS;
+        broker->reported = -1;
+        // Half the brokers overloaded, the others mostly idle
+        broker->load = i < (nbr_brokers + 1) / 2
+            ? BURST_INTERVAL / 2 : BURST_INTERVAL * 2;
+        broker->burst_at = randof(broker->load);
+        queue_init(&broker->local, sizeof(task_t));
+        queue_init(&broker->cloud, sizeof(task_t));
+        broker->peers = peers_new();
+    }
+    for (int i = 0; i < nbr_brokers; ++i) {
+        for (int j = 0; j < nbr_brokers; ++j) {
+            if (j != i)
+                peers_add(brokers[i].peers, brokers[j].name);
+        }
+    }
+    queue_t in_flight;      // Tasks on their way to a peer
+    queue_init(&in_flight, sizeof(task_t));
+    queue_t states;         // State messages on their way to peers
+    queue_init(&states, sizeof(state_t));
+
+    for (long now = 0; now < seconds * 1000L; ++now) {
+        // Deliver state messages to all peers
+        state_t* state;
+        while ((state = (state_t*)queue_first(&states))
+                && state->deliver_at <= now) {
+            for (int i = 0; i < nbr_brokers; ++i) {
+                if (i == state->broker)
+                    continue;
+                brokers[i].cloud_capacity = state->capacity;
+                peers_update(brokers[i].peers, brokers[state->broker].name,
+                        state->capacity, (uint64_t)now);
+            }
+            queue_pop(&states);
+        }
+        for (int i = 0; i < nbr_brokers; ++i) {
+            broker_t* broker = &brokers[i];
+            // Workers which are done
+            for (int w = 0; w < NBR_WORKERS; ++w) {
+                if (broker->busy_until[w] && broker->busy_until[w] <= now) {
+                    broker->busy_until[w] = 0;
+                    broker->capacity++;
+                }
+            }
+            // Bursts from clients
+            if (now >= broker->burst_at) {
+                int burst = randof(BURST_MAX);
+                for (int t = 0; t < burst; ++t) {
+                    task_t task = { now, 0, 0 };
+                    queue_push(&broker->local, &task);
+                    stats->tasks++;
+                }
+                broker->burst_at = now + 1 + randof(2 * broker->load);
+            }
+        }
+        // Tasks reaching peers
+        task_t* task;
+        while ((task = (task_t*)queue_first(&in_flight))
+                && task->arrive_at <= now) {
+            broker_t* peer = &brokers[task->peer];
+            if (peer->capacity == 0 || peer->cloud.size)
+                stats->bounced++;
+            queue_push(&peer->cloud, task);
+            queue_pop(&in_flight);
+        }
+        for (int i = 0; i < nbr_brokers; ++i) {
+            broker_t* broker = &brokers[i];
+            // Tasks from peers can only go to local workers
+            while (broker->capacity && (task = (task_t*)queue_first(
+                    &broker->cloud))) {
+                s_start(broker, task, now, stats);
+                queue_pop(&broker->cloud);
+            }
+            while ((task = (task_t*)queue_first(&broker->local))) {
+                if (broker->capacity) {
+                    s_start(broker, task, now, stats);
+                    stats->local++;
+                } else {
+                    int peer = s_route(brokers, nbr_brokers, i, policy,
+                            peer_policy, now);
+                    if (peer < 0)
+                        break;  // Wait for capacity
+                    task->arrive_at = now + HOP_DELAY;
+                    task->peer = peer;
+                    queue_push(&in_flight, task);
+                    stats->cloud++;
+                }
+                queue_pop(&broker->local);
+            }
+            // Report capacity when it changes; the table expires reports,
+            // so brokers using it also report now and then
+            if (broker->capacity != broker->reported
+                    || (policy == POLICY_TABLE && now >= broker->report_at)) {
+                state_t report = { now + STATE_DELAY, i, broker->capacity };
+                queue_push(&states, &report);
+                broker->reported = broker->capacity;
+                broker->report_at = now + STATE_INTERVAL;
+                stats->state_messages++;
+            }
+        }
+    }
+
+    for (int i = 0; i < nbr_brokers; ++i) {
+        free(brokers[i].local.items);
+        free(brokers[i].cloud.items);
+        peers_destroy(&brokers[i].peers);
+    }
+    free(brokers);
+    free(in_flight.items);
+    free(states.items);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int nbr_brokers = argc > 1 ? atoi(argv[1]) : 8;
+    int seconds = argc > 2 ? atoi(argv[2]) : 600;
+    unsigned int seed = argc > 3 ? (unsigned int)atoi(argv[3]) : 1;
+    if (nbr_brokers < 2 || nbr_brokers > MAX_BROKERS || seconds < 1) {
+        printf("syntax: capacity_sim [brokers] [seconds] [seed]\n");
+        return 0;
+    }
+
+    printf("%d brokers, %d workers each, %d seconds\n",
+            nbr_brokers, NBR_WORKERS, seconds);
+    printf("%-14s %9s %9s %9s %9s %9s %10s %10s\n", "policy", "tasks",
+            "local", "cloud", "bounced", "bounced%", "wait avg", "wait max");
+    for (int p = -1; p < PEER_POLICY_COUNT; ++p) {
+        // Policy last first, then table with each peer selection policy
+        policy_t policy = p < 0 ? POLICY_LAST : POLICY_TABLE;
+        peer_policy_t peer_policy =
+            p < 0 ? PEER_POLICY_RANDOM : (peer_policy_t)p;
+        char name[32];
+        if (p < 0)
+            strcpy(name, POLICY_NAMES[policy]);
+        else
+            sprintf(name, "%s/%s", POLICY_NAMES[policy],
+                    PEER_POLICY_NAMES[peer_policy]);
+        stats_t stats;
+        s_simulate(nbr_brokers, seconds, seed, policy, peer_policy, &stats);
+        printf("%-14s %9ld %9ld %9ld %9ld %8.1f%% %8.1fms %8ldms\n",
+                name, stats.tasks, stats.local, stats.cloud,
+                stats.bounced,
+                stats.cloud ? 100.0 * stats.bounced / stats.cloud : 0.0,
+                stats.started ? stats.wait / stats.started : 0.0,
+                stats.wait_max);
+        printf("%-14s %d state messages\n", "", (int)stats.state_messages);
+    }
+    return 0;
+}
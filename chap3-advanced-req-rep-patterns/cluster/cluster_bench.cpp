@@ -0,0 +1,299 @@
+/**
+ * @file cluster_bench.cpp
+ *
+ * @breif Cloud routing benchmark
+ * Runs a cluster of brokers like prototype.cpp in one process, once per peer
+ * selection policy, and compares the latency clients see and how many tasks
+ * go to the cloud. Half of the brokers have more clients than their workers
+ * can keep up with, the others few, so the overloaded ones depend on the
+ * policy picking peers which can take their tasks. Each policy runs with
+ * single loop brokers, then threaded ones, see broker.h. With -g, brokers
+ * spread state by gossip rather than to all peers; with -v, they log tasks
+ * and monitor summaries, to a temporary file.
+ * Brokers share one context and talk over inproc, which takes libzmq 4 as
+ * they connect to peers before those bind; -ipc has them talk over the
+ * transport of prototype.cpp instead. -l sets the load profile: clients of
+ * busy and idle brokers, workers of each, msecs clients idle up to between
+ * bursts, tasks per burst, and msecs workers take per task. -r has clients
+ * send that many tasks per second instead, open loop with Poisson arrivals,
+ * -R evenly spaced, see loadgen.h; latency then counts from when tasks were
+ * meant to go out. -s puts brokers in a ring, connected to that many nearest
+ * on either side rather than to all, and -m lets tasks go through that many
+ * peers, see hops.h. With -c, clients send tasks straight to whichever
+ * broker has spare capacity, see direct.h.
+ *
+ *   cluster_bench [-g] [-v] [-ipc]
+ *                 [-l busy,idle,workers,interval,burst,service] [-r|-R rate]
+ *                 [-s neighbours] [-m hops] [-c] [brokers] [seconds] [policy]
+ */
+#include <czmq.h>
+#include "czmq_fix.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "broker.h"
+#include "endpoint.h"
+
+namespace {
+
+const int MAX_BROKERS = 32;
+
+struct load_t {
+    int busy_clients;       // Clients of an overloaded broker
+    int idle_clients;       // Clients of the others
+    int nbr_workers;
+    int burst_interval;     // msecs
+    int burst_max;
+    int service_time;       // msecs
+    double rate;            // Tasks per second per client, 0 for bursts
+    loadgen_arrivals_t arrivals;
+};
+
+const load_t DEFAULT_LOAD = { 10, 2, 5, 500, 15, 20, 0, LOADGEN_POISSON };
+
+struct topology_t {
+    int neighbours;         // Peers on either side in a ring, 0 for all
+    int max_hops;           // Peers a task may go through
+    bool direct;            // Clients pick the broker, see direct.h
+};
+
+struct broker_args_t {
+    broker_config_t config;
+    broker_stats_t stats;
+    char name[32];
+    char* peers[MAX_BROKERS];
+    char peer_names[MAX_BROKERS][32];
+    volatile bool stop;
+};
+
+void* broker_task(void* arg)
+{
+    broker_args_t* args = (broker_args_t*)arg;
+    broker_run(&args->config, &args->stats);
+    return 0;
+}
+
+int compare_latency(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Ring distance between brokers
+int s_distance(int nbr_brokers, int i, int j)
+{
+    int distance = i > j ? i - j : j - i;
+    return distance < nbr_brokers - distance
+        ? distance : nbr_brokers - distance;
+}
+
+void s_run(int nbr_brokers, int seconds, peer_policy_t policy, bool gossip,
+        bool threaded, const load_t* load, const topology_t* topology,
+        zctx_t* ctx, FILE* log)
+{
+    // Names are unique per run, as tasks of the last run may linger a while
+    broker_args_t* brokers =
+        (broker_args_t*)calloc(nbr_brokers, sizeof(broker_args_t));
+    for (int i = 0; i < nbr_brokers; ++i) {
+        sprintf(brokers[i].name, "bench-%s-%c%d", PEER_POLICY_NAMES[policy],
+                threaded ? 't' : 's', i);
+        // Sharing a context, brokers reach each other over inproc
+        if (ctx)
+            endpoint_register(brokers[i].name, ENDPOINT_PROCESS);
+    }
+    for (int i = 0; i < nbr_brokers; ++i) {
+        broker_args_t* args = &brokers[i];
+        int nbr_peers = 0;
+        for (int j = 0; j < nbr_brokers; ++j) {
+            if (j == i || (topology->neighbours
+                    && s_distance(nbr_brokers, i, j) > topology->neighbours))
+                continue;
+            strcpy(args->peer_names[nbr_peers], brokers[j].name);
+            args->peers[nbr_peers] = args->peer_names[nbr_peers];
+            nbr_peers++;
+        }
+        broker_config_init(&args->config, args->name, args->peers, nbr_peers);
+        args->config.nbr_clients = i < (nbr_brokers + 1) / 2
+            ? load->busy_clients : load->idle_clients;
+        args->config.nbr_workers = load->nbr_workers;
+        args->config.burst_interval = load->burst_interval;
+        args->config.burst_max = load->burst_max;
+        args->config.service_time = load->service_time;
+        args->config.rate = load->rate;
+        args->config.arrivals = load->arrivals;
+        args->config.policy = policy;
+        args->config.max_hops = topology->max_hops;
+        args->config.direct = topology->direct;
+        args->config.gossip = gossip;
+        args->config.threaded = threaded;
+        args->config.verbose = log != 0;
+        args->config.log = log;
+        args->config.stop = &args->stop;
+        args->config.ctx = ctx;
+    }
+
+    for (int i = 0; i < nbr_brokers; ++i)
+        zthread_new(broker_task, &brokers[i]);
+    zclock_sleep(seconds * 1000);
+    for (int i = 0; i < nbr_brokers; ++i)
+        brokers[i].stop = true;
+    // Give brokers and their tasks time to notice, and clients time to
+    // give up on tasks lost with the brokers
+    zclock_sleep(1000);
+
+    uint64_t local = 0, cloud = 0, forwarded = 0, direct = 0;
+    uint64_t replies = 0, lost = 0;
+    uint64_t state_changes = 0, state_reports = 0, state_messages = 0;
+    int64_t* latencies =
+        (int64_t*)malloc(nbr_brokers * BROKER_LATENCIES * sizeof(int64_t));
+    int nbr_latencies = 0;
+    for (int i = 0; i < nbr_brokers; ++i) {
+        broker_stats_t* stats = &brokers[i].stats;
+        local += stats->local;
+        cloud += stats->cloud;
+        forwarded += stats->forwarded;
+        direct += stats->direct;
+        replies += stats->replies;
+        lost += stats->lost;
+        state_changes += stats->state_changes;
+        state_reports += stats->state_reports;
+        state_messages += stats->state_messages;
+        int kept = stats->replies < (uint64_t)BROKER_LATENCIES
+            ? (int)stats->replies : BROKER_LATENCIES;
+        memcpy(latencies + nbr_latencies, stats->latencies,
+                kept * sizeof(int64_t));
+        nbr_latencies += kept;
+    }
+    qsort(latencies, nbr_latencies, sizeof(int64_t), compare_latency);
+    double sum = 0;
+    for (int i = 0; i < nbr_latencies; ++i)
+        sum += latencies[i];
+    int64_t p50 = nbr_latencies ? latencies[nbr_latencies / 2] : 0;
+    int64_t p99 = nbr_latencies ? latencies[nbr_latencies * 99 / 100] : 0;
+    uint64_t routed = local + cloud;
+    printf("%-8s %-8s %8.0f/s %7.1f%% %7.1f%% %8.1fms %8.1fms %8.1fms %6d\n",
+            PEER_POLICY_NAMES[policy], threaded ? "threaded" : "single",
+            (double)replies / seconds,
+            routed ? 100.0 * local / routed : 0.0,
+            routed ? 100.0 * cloud / routed : 0.0,
+            nbr_latencies ? sum / nbr_latencies / 1000 : 0.0,
+            p50 / 1000.0, p99 / 1000.0, (int)lost);
+    printf("%-17s %d reports for %d capacity changes, %.1f%% saved, "
+            "%d state messages\n", "", (int)state_reports, (int)state_changes,
+            state_changes > state_reports
+                ? 100.0 * (state_changes - state_reports) / state_changes
+                : 0.0, (int)state_messages);
+    if (topology->max_hops > 1)
+        printf("%-17s %d tasks passed on by peers\n", "", (int)forwarded);
+    // A task goes through one broker, and one more per time it's passed on
+    if (topology->direct)
+        printf("%-17s %d tasks sent straight to peers, %.2f broker hops per "
+                "task\n", "", (int)direct,
+                replies ? 1 + (double)(cloud + forwarded) / replies : 0.0);
+    free(latencies);
+    for (int i = 0; ctx && i < nbr_brokers; ++i)
+        endpoint_unregister(brokers[i].name);
+    // Not freeing brokers, clients still waiting on lost tasks read config
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    bool gossip = false;
+    bool inproc = true;
+    load_t load = DEFAULT_LOAD;
+    topology_t topology = { 0, 1, false };
+    bool valid = true;
+    FILE* log = 0;
+    while (argc > 1 && argv[1][0] == '-') {
+        if (streq(argv[1], "-g"))
+            gossip = true;
+        else if (streq(argv[1], "-v") && !log)
+            log = tmpfile();
+        else if (streq(argv[1], "-ipc"))
+            inproc = false;
+        else if (streq(argv[1], "-c"))
+            topology.direct = true;
+        else if (streq(argv[1], "-l") && argc > 2) {
+            valid = sscanf(argv[2], "%d,%d,%d,%d,%d,%d", &load.busy_clients,
+                    &load.idle_clients, &load.nbr_workers,
+                    &load.burst_interval, &load.burst_max,
+                    &load.service_time) == 6
+                && load.busy_clients >= 0 && load.idle_clients >= 0
+                && load.nbr_workers > 0 && load.burst_interval >= 0
+                && load.burst_max > 0 && load.service_time >= 0;
+            argc--;
+            argv++;
+        } else if ((streq(argv[1], "-s") || streq(argv[1], "-m"))
+                && argc > 2) {
+            int value = atoi(argv[2]);
+            if (streq(argv[1], "-s"))
+                topology.neighbours = value;
+            else
+                topology.max_hops = value;
+            valid = value > 0;
+            argc--;
+            argv++;
+        } else if ((streq(argv[1], "-r") || streq(argv[1], "-R"))
+                && argc > 2) {
+            load.rate = atof(argv[2]);
+            load.arrivals = streq(argv[1], "-r")
+                ? LOADGEN_POISSON : LOADGEN_CONSTANT;
+            valid = load.rate > 0;
+            argc--;
+            argv++;
+        }
+        argc--;
+        argv++;
+    }
+    int nbr_brokers = argc > 1 ? atoi(argv[1]) : 4;
+    int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    peer_policy_t policy = PEER_POLICY_COUNT;  // All of them
+    if (!valid || nbr_brokers < 2 || nbr_brokers > MAX_BROKERS || seconds < 1
+            || (argc > 3 && !peers_policy_parse(argv[3], &policy))
+            || (topology.direct && gossip)) {
+        printf("syntax: cluster_bench [-g] [-v] [-ipc] "
+                "[-l busy,idle,workers,interval,burst,service]\n"
+                "                     [-r|-R rate] [-s neighbours] [-m hops] "
+                "[-c] [brokers] [seconds] [policy]\n");
+        return 0;
+    }
+    srand((unsigned int)time(0));
+    // Never destroyed, clients still waiting on lost tasks use it
+    zctx_t* ctx = inproc ? zctx_new() : 0;
+
+    printf("%d brokers, %d workers each, %d seconds per run, state by %s, "
+            "over %s%s\n", nbr_brokers, load.nbr_workers, seconds,
+            gossip ? "gossip" : "broadcast", inproc ? "inproc" : "ipc",
+            log ? ", logging" : "");
+    if (load.rate > 0)
+        printf("%d clients of busy brokers, %d of idle ones, %.1f tasks/s "
+                "each, %s arrivals, %dms per task\n", load.busy_clients,
+                load.idle_clients, load.rate,
+                load.arrivals == LOADGEN_POISSON ? "Poisson" : "constant",
+                load.service_time);
+    else
+        printf("%d clients of busy brokers, %d of idle ones, bursts of up to "
+                "%d tasks every %dms at most, %dms per task\n",
+                load.busy_clients, load.idle_clients, load.burst_max - 1,
+                load.burst_interval, load.service_time);
+    if (topology.neighbours)
+        printf("ring of brokers with %d neighbours on either side, tasks go "
+                "through %d peers at most\n", topology.neighbours,
+                topology.max_hops);
+    if (topology.direct)
+        printf("clients send tasks straight to brokers with spare capacity\n");
+    printf("%-8s %-8s %10s %8s %8s %10s %10s %10s %6s\n", "policy", "design",
+            "replies", "local", "cloud", "avg", "p50", "p99", "lost");
+    for (int p = 0; p < PEER_POLICY_COUNT; ++p) {
+        if (policy != PEER_POLICY_COUNT && policy != p)
+            continue;
+        s_run(nbr_brokers, seconds, (peer_policy_t)p, gossip, false, &load,
+                &topology, ctx, log);
+        s_run(nbr_brokers, seconds, (peer_policy_t)p, gossip, true, &load,
+                &topology, ctx, log);
+    }
+    return 0;
+}
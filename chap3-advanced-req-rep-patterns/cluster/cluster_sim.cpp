@@ -0,0 +1,444 @@
+/**
+ * @file cluster_sim.cpp
+ *
+ * @breif Discrete-event simulation of cloud routing
+ * Simulates a cluster of brokers like cluster_bench.cpp, with the load of its
+ * clients and workers, but on a virtual clock: sockets and sleeps are events
+ * in a queue, taken in time order, so an hour of traffic takes seconds, and
+ * runs with the same seed are the same. Brokers route as broker.cpp does,
+ * with the peer table of peers.h and the state reporter of state.h: local
+ * workers first, then a peer with spare capacity picked by policy, else the
+ * task waits; tasks from peers only go to local workers. Clients send their
+ * tasks one at a time in bursts, as client_task does. Compares latency, cloud
+ * routing and tasks bounced to peers which had no free worker left, per
+ * policy.
+ *
+ *   cluster_sim [brokers] [seconds] [seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "state.h"
+
+namespace {
+
+const int MAX_BROKERS = 64;
+const int BUSY_CLIENTS = 10;        // Clients of an overloaded broker
+const int IDLE_CLIENTS = 2;         // Clients of the others
+const int NBR_WORKERS = 5;
+const int BURST_INTERVAL = 500;     // msecs
+const int BURST_MAX = 15;
+const int SERVICE_TIME = 20;        // msecs
+const int64_t HOP_DELAY = 100;      // usecs, from a socket to its peer
+const int64_t STATE_DELAY = 200;    // usecs, for a state message
+
+inline int randof(int n) { return rand() % n; }
+
+enum event_type_t {
+    EVENT_CLIENT,           // Client wakes up to send a task
+    EVENT_TASK,             // Task reaches the local frontend of its broker
+    EVENT_CLOUD_TASK,       // Task reaches the cloud frontend of a peer
+    EVENT_DONE,             // Worker is done with a task
+    EVENT_REPLY,            // Reply reaches the client
+    EVENT_STATE,            // State message reaches the peers of a broker
+    EVENT_REPORT            // Broker's state reporter may be due
+};
+
+struct task_t {
+    int client;
+    int64_t sent_at;        // usecs
+};
+
+struct event_t {
+    int64_t at;             // usecs
+    uint64_t seq;           // Events at the same time go in order
+    event_type_t type;
+    int broker;             // Broker the event happens at
+    int value;              // Capacity of a state message
+    task_t task;
+};
+
+// Queue of events, a binary heap by time
+struct events_t {
+    event_t* items;
+    size_t size;
+    size_t capacity;
+    uint64_t seq;
+    uint64_t taken;
+};
+
+bool event_before(const event_t* a, const event_t* b)
+{
+    return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+void events_push(events_t* events, event_t event)
+{
+    if (events->size == events->capacity) {
+        events->capacity = events->capacity ? events->capacity * 2 : 1024;
+        events->items = (event_t*)realloc(events->items,
+                events->capacity * sizeof(event_t));
+    }
+    event.seq = events->seq++;
+    size_t i = events->size++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!event_before(&event, &events->items[parent]))
+            break;
+        events->items[i] = events->items[parent];
+        i = parent;
+    }
+    events->items[i] = event;
+}
+
+event_t events_pop(events_t* events)
+{
+    event_t first = events->items[0];
+    event_t last = events->items[--events->size];
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= events->size)
+            break;
+        if (child + 1 < events->size
+                && event_before(&events->items[child + 1],
+                    &events->items[child]))
+            child++;
+        if (!event_before(&events->items[child], &last))
+            break;
+        events->items[i] = events->items[child];
+        i = child;
+    }
+    if (events->size)
+        events->items[i] = last;
+    events->taken++;
+    return first;
+}
+
+// FIFO of tasks waiting for the router, growing as needed
+struct task_queue_t {
+    task_t* items;
+    size_t head;
+    size_t size;
+    size_t capacity;
+};
+
+void task_queue_push(task_queue_t* queue, const task_t* task)
+{
+    if (queue->size == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+        task_t* items = (task_t*)malloc(capacity * sizeof(task_t));
+        for (size_t i = 0; i < queue->size; ++i)
+            items[i] = queue->items[(queue->head + i) % queue->capacity];
+        free(queue->items);
+        queue->items = items;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    queue->items[(queue->head + queue->size++) % queue->capacity] = *task;
+}
+
+task_t task_queue_pop(task_queue_t* queue)
+{
+    task_t task = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->size--;
+    return task;
+}
+
+struct client_t {
+    int broker;
+    int burst;              // Tasks left in this burst
+};
+
+struct broker_t {
+    char name[16];
+    int capacity;           // Free workers
+    task_queue_t local;     // Tasks from clients, waiting
+    task_queue_t cloud;     // Tasks from peers, waiting
+    peers_t* peers;
+    state_reporter_t reporter;
+    int64_t report_at;      // usecs, an EVENT_REPORT is due then, 0 if none
+};
+
+struct stats_t {
+    long tasks;
+    long local;             // Client tasks served by local workers
+    long cloud;             // Client tasks routed to peers
+    long bounced;           // Reached a peer with no free worker
+    long state_messages;
+    int64_t* latencies;     // usecs, of all replies
+    size_t nbr_latencies;
+    size_t max_latencies;
+};
+
+struct sim_t {
+    broker_t* brokers;
+    int nbr_brokers;
+    client_t* clients;
+    events_t events;
+    peer_policy_t policy;
+    stats_t* stats;
+};
+
+void s_schedule(sim_t* sim, int64_t at, event_type_t type, int broker,
+        const task_t* task)
+{
+    event_t event;
+    memset(&event, 0, sizeof(event_t));
+    event.at = at;
+    event.type = type;
+    event.broker = broker;
+    if (task)
+        event.task = *task;
+    events_push(&sim->events, event);
+}
+
+// Client sends its next task, or sleeps until its next burst
+void s_client_next(sim_t* sim, int c, int64_t now)
+{
+    client_t* client = &sim->clients[c];
+    if (client->burst == 0) {
+        client->burst = randof(BURST_MAX);
+        task_t wakeup = { c, 0 };
+        s_schedule(sim, now + randof(BURST_INTERVAL) * 1000LL, EVENT_CLIENT,
+                client->broker, &wakeup);
+        return;
+    }
+    client->burst--;
+    task_t task = { c, now };
+    s_schedule(sim, now + HOP_DELAY, EVENT_TASK, client->broker, &task);
+    sim->stats->tasks++;
+}
+
+// Give a task to a free worker, which takes 0 or 1 service time
+void s_start(sim_t* sim, int b, const task_t* task, int64_t now)
+{
+    sim->brokers[b].capacity--;
+    s_schedule(sim, now + randof(2) * SERVICE_TIME * 1000LL, EVENT_DONE, b,
+            task);
+}
+
+// Route as many tasks as the broker can, as router_route does, then report
+// its capacity if the reporter says so
+void s_route(sim_t* sim, int b, int64_t now)
+{
+    broker_t* broker = &sim->brokers[b];
+    uint64_t now_msecs = (uint64_t)(now / 1000);
+    while (broker->capacity || peers_spare(broker->peers, now_msecs)) {
+        if (broker->local.size) {
+            task_t task = task_queue_pop(&broker->local);
+            if (broker->capacity) {
+                s_start(sim, b, &task, now);
+                sim->stats->local++;
+            } else {
+                peer_t* peer = peers_select(broker->peers, now_msecs,
+                        sim->policy);
+                peers_routed(broker->peers, peer, now_msecs);
+                s_schedule(sim, now + HOP_DELAY, EVENT_CLOUD_TASK,
+                        atoi(peer->name + 1), &task);
+                sim->stats->cloud++;
+            }
+        } else if (broker->capacity && broker->cloud.size) {
+            task_t task = task_queue_pop(&broker->cloud);
+            s_start(sim, b, &task, now);
+        } else {
+            break;
+        }
+    }
+
+    if (state_reporter_due(&broker->reporter, broker->capacity, now_msecs)) {
+        event_t event;
+        memset(&event, 0, sizeof(event_t));
+        event.at = now + STATE_DELAY;
+        event.type = EVENT_STATE;
+        event.broker = b;
+        event.value = broker->capacity;
+        events_push(&sim->events, event);
+        sim->stats->state_messages += sim->nbr_brokers - 1;
+    }
+    // Wake up when the next report may be due, unless already going to
+    int64_t report_at = now + 1000LL * state_reporter_wait(&broker->reporter,
+            broker->capacity, now_msecs);
+    if (broker->report_at <= now || report_at < broker->report_at) {
+        broker->report_at = report_at;
+        s_schedule(sim, report_at, EVENT_REPORT, b, 0);
+    }
+}
+
+void s_latency(stats_t* stats, int64_t latency)
+{
+    if (stats->nbr_latencies == stats->max_latencies) {
+        stats->max_latencies = stats->max_latencies
+            ? stats->max_latencies * 2 : 65536;
+        stats->latencies = (int64_t*)realloc(stats->latencies,
+                stats->max_latencies * sizeof(int64_t));
+    }
+    stats->latencies[stats->nbr_latencies++] = latency;
+}
+
+void s_simulate(int nbr_brokers, int seconds, unsigned int seed,
+        peer_policy_t policy, stats_t* stats, uint64_t* events_taken)
+{
+    srand(seed);
+    memset(stats, 0, sizeof(stats_t));
+    sim_t sim;
+    memset(&sim, 0, sizeof(sim_t));
+    sim.nbr_brokers = nbr_brokers;
+    sim.policy = policy;
+    sim.stats = stats;
+    sim.brokers = (broker_t*)calloc(nbr_brokers, sizeof(broker_t));
+    for (int i = 0; i < nbr_brokers; ++i) {
+        broker_t* broker = &sim.brokers[i];
+        sprintf(broker->name, "s%d", i);
+        broker->capacity = NBR_WORKERS;
+        broker->peers = peers_new();
+        state_reporter_init(&broker->reporter);
+    }
+    for (int i = 0; i < nbr_brokers; ++i) {
+        for (int j = 0; j < nbr_brokers; ++j) {
+            if (j != i)
+                peers_add(sim.brokers[i].peers, sim.brokers[j].name);
+        }
+    }
+    // Half the brokers overloaded, the others mostly idle
+    int nbr_clients = 0;
+    for (int i = 0; i < nbr_brokers; ++i)
+        nbr_clients += i < (nbr_brokers + 1) / 2
+            ? BUSY_CLIENTS : IDLE_CLIENTS;
+    sim.clients = (client_t*)calloc(nbr_clients, sizeof(client_t));
+    int c = 0;
+    for (int i = 0; i < nbr_brokers; ++i) {
+        int clients = i < (nbr_brokers + 1) / 2
+            ? BUSY_CLIENTS : IDLE_CLIENTS;
+        for (int j = 0; j < clients; ++j, ++c) {
+            sim.clients[c].broker = i;
+            s_client_next(&sim, c, 0);
+        }
+        s_route(&sim, i, 0);
+    }
+
+    int64_t end = seconds * 1000000LL;
+    while (sim.events.size && sim.events.items[0].at < end) {
+        event_t event = events_pop(&sim.events);
+        int64_t now = event.at;
+        int b = event.broker;
+        broker_t* broker = &sim.brokers[b];
+        switch (event.type) {
+            case EVENT_CLIENT:
+                s_client_next(&sim, event.task.client, now);
+                break;
+            case EVENT_TASK:
+                task_queue_push(&broker->local, &event.task);
+                s_route(&sim, b, now);
+                break;
+            case EVENT_CLOUD_TASK:
+                if (broker->capacity == 0)
+                    stats->bounced++;
+                task_queue_push(&broker->cloud, &event.task);
+                s_route(&sim, b, now);
+                break;
+            case EVENT_DONE: {
+                // The reply goes back by the way the task came, a hop more
+                // if it came from a peer
+                broker->capacity++;
+                int origin = sim.clients[event.task.client].broker;
+                int64_t delay = origin == b ? HOP_DELAY : 2 * HOP_DELAY;
+                s_schedule(&sim, now + delay, EVENT_REPLY, origin,
+                        &event.task);
+                s_route(&sim, b, now);
+                break;
+            }
+            case EVENT_REPLY:
+                s_latency(stats, now - event.task.sent_at);
+                s_client_next(&sim, event.task.client, now);
+                break;
+            case EVENT_STATE:
+                for (int i = 0; i < nbr_brokers; ++i) {
+                    if (i == b)
+                        continue;
+                    peers_update(sim.brokers[i].peers, broker->name,
+                            event.value, (uint64_t)(now / 1000));
+                    s_route(&sim, i, now);
+                }
+                break;
+            case EVENT_REPORT:
+                if (now == broker->report_at)
+                    broker->report_at = 0;
+                s_route(&sim, b, now);
+                break;
+        }
+    }
+    *events_taken = sim.events.taken;
+
+    for (int i = 0; i < nbr_brokers; ++i) {
+        free(sim.brokers[i].local.items);
+        free(sim.brokers[i].cloud.items);
+        peers_destroy(&sim.brokers[i].peers);
+    }
+    free(sim.brokers);
+    free(sim.clients);
+    free(sim.events.items);
+}
+
+int64_t s_usecs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int compare_latency(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int nbr_brokers = argc > 1 ? atoi(argv[1]) : 4;
+    int seconds = argc > 2 ? atoi(argv[2]) : 3600;
+    unsigned int seed = argc > 3 ? (unsigned int)atoi(argv[3]) : 1;
+    if (nbr_brokers < 2 || nbr_brokers > MAX_BROKERS || seconds < 1) {
+        printf("syntax: cluster_sim [brokers] [seconds] [seed]\n");
+        return 0;
+    }
+
+    printf("%d brokers, %d workers each, %d simulated seconds, seed %u\n",
+            nbr_brokers, NBR_WORKERS, seconds, seed);
+    printf("%-8s %10s %8s %8s %10s %10s %10s %8s %10s\n", "policy",
+            "replies", "local", "cloud", "avg", "p50", "p99", "bounced",
+            "run time");
+    for (int p = 0; p < PEER_POLICY_COUNT; ++p) {
+        stats_t stats;
+        uint64_t events;
+        int64_t start = s_usecs();
+        s_simulate(nbr_brokers, seconds, seed, (peer_policy_t)p, &stats,
+                &events);
+        int64_t elapsed = s_usecs() - start;
+        size_t n = stats.nbr_latencies;
+        qsort(stats.latencies, n, sizeof(int64_t), compare_latency);
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            sum += stats.latencies[i];
+        long routed = stats.local + stats.cloud;
+        printf("%-8s %8.0f/s %7.1f%% %7.1f%% %8.1fms %8.1fms %8.1fms "
+                "%8ld %8.1fs\n", PEER_POLICY_NAMES[p], (double)n / seconds,
+                routed ? 100.0 * stats.local / routed : 0.0,
+                routed ? 100.0 * stats.cloud / routed : 0.0,
+                n ? sum / n / 1000 : 0.0,
+                n ? stats.latencies[n / 2] / 1000.0 : 0.0,
+                n ? stats.latencies[n * 99 / 100] / 1000.0 : 0.0,
+                stats.bounced, elapsed / 1e6);
+        printf("%-8s %ld tasks, %ld state messages, %.1fM events\n", "",
+                stats.tasks, stats.state_messages, events / 1e6);
+        free(stats.latencies);
+    }
+    return 0;
+}
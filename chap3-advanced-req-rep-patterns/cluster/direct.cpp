@@ -0,0 +1,98 @@
+// cluster/direct.cpp
+//
+#include "direct.h"
+
+#include <czmq.h>
+#include "czmq_fix.h"
+#include <assert.h>
+#include <stdlib.h>
+
+#include "endpoint.h"
+#include "state.h"
+
+struct direct_client_t {
+    const char* home;
+    peer_policy_t policy;
+    peers_t* brokers;       // Spare capacity of each broker, home first
+    void** frontends;       // Of each broker, in the same order
+    void* state;            // Subscribed to the state backend of each broker
+};
+
+direct_client_t* direct_client_new(void* ctx, const char* home, char** peers,
+        int nbr_peers, peer_policy_t policy)
+{
+    assert(ctx);
+    assert(home);
+    direct_client_t* self =
+        (direct_client_t*)calloc(1, sizeof(direct_client_t));
+    assert(self);
+    self->home = home;
+    self->policy = policy;
+    self->brokers = peers_new();
+    self->frontends = (void**)malloc((nbr_peers + 1) * sizeof(void*));
+    assert(self->frontends);
+    self->state = zsocket_new((zctx_t*)ctx, ZMQ_SUB);
+    zsocket_set_subscribe(self->state, (char*)"");
+    char endpoint[256];
+    for (int i = 0; i <= nbr_peers; ++i) {
+        const char* name = i == 0 ? home : peers[i - 1];
+        peers_add(self->brokers, name);
+        self->frontends[i] = zsocket_new((zctx_t*)ctx, ZMQ_DEALER);
+        zsocket_connect(self->frontends[i], localfe_endpoint(name, endpoint));
+        zsocket_connect(self->state, state_endpoint(name, endpoint));
+    }
+    return self;
+}
+
+void direct_client_destroy(direct_client_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        direct_client_t* self = *self_p;
+        // Sockets go with the context
+        peers_destroy(&self->brokers);
+        free(self->frontends);
+        free(self);
+        *self_p = 0;
+    }
+}
+
+void* direct_client_pick(direct_client_t* self, uint64_t now, bool* home)
+{
+    assert(self);
+    // Take the reports which came since the last task
+    unsigned char data[STATE_MSG_MAX + 1];
+    int size;
+    while ((size = zmq_recv(self->state, data, sizeof(data), ZMQ_DONTWAIT))
+            != -1) {
+        char name[PEER_NAME_MAX + 1];
+        int capacity;
+        if (state_decode(data, size, name, &capacity))
+            peers_update(self->brokers, name, capacity, now);
+    }
+
+    peer_t* target = &self->brokers->items[0];
+    if (peers_spare_of(self->brokers, target, now) == 0) {
+        peer_t* peer = peers_select(self->brokers, now, self->policy,
+                &self->home, 1);
+        if (peer)
+            target = peer;
+    }
+    peers_routed(self->brokers, target, now);
+    if (home)
+        *home = target == &self->brokers->items[0];
+    return self->frontends[target - self->brokers->items];
+}
+
+int direct_client_size(direct_client_t* self)
+{
+    assert(self);
+    return self->brokers->size;
+}
+
+void* direct_client_frontend(direct_client_t* self, int index)
+{
+    assert(self);
+    assert(index >= 0 && index < self->brokers->size);
+    return self->frontends[index];
+}
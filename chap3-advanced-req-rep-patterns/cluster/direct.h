@@ -0,0 +1,35 @@
+// cluster/direct.h
+//
+// Client which routes its own tasks. Rather than sending all tasks to its own
+// broker, which sends those its workers can't take on to a peer, the client
+// subscribes to the state flow of the brokers itself, and sends each task
+// straight to the frontend of a broker with spare capacity: its own broker
+// while that has any, else a peer picked by policy, as the broker would.
+// Spillover then takes no hop from broker to broker. Tasks the client sends
+// count against the broker's capacity until it reports again; with no broker
+// known to have any, tasks go to the client's own.
+// Capacity only comes from the state messages brokers broadcast, so brokers
+// spreading state by gossip, see gossip.h, can't be routed to directly.
+//
+#ifndef CLUSTER_DIRECT_H_
+#define CLUSTER_DIRECT_H_
+
+#include <stdint.h>
+
+#include "peers.h"
+
+struct direct_client_t;
+
+// Create a client of broker home with those peers, in ctx, a zctx_t
+direct_client_t* direct_client_new(void* ctx, const char* home, char** peers,
+        int nbr_peers, peer_policy_t policy = PEER_POLICY_RANDOM);
+void direct_client_destroy(direct_client_t** self_p);
+
+// Frontend to send a task to at time now, a DEALER socket, so tasks go with
+// an empty delimiter frame; home tells whether it's the client's own broker's
+void* direct_client_pick(direct_client_t* self, uint64_t now, bool* home);
+// Frontends, which replies come from, by index
+int direct_client_size(direct_client_t* self);
+void* direct_client_frontend(direct_client_t* self, int index);
+
+#endif // CLUSTER_DIRECT_H_
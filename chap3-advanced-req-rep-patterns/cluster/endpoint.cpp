@@ -2,32 +2,131 @@
 //
 #include "endpoint.h"
 
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-static char endpoint_buf[256] = {0};
+#ifdef _MSC_VER
+# define ENDPOINT_THREAD_LOCAL __declspec(thread)
+#else
+# define ENDPOINT_THREAD_LOCAL __thread
+#endif
 
+namespace {  // Internal
+
+const int PORTS = 6;                // Endpoints per broker
+
+struct entry_t {
+    char name[256];                 // Empty while the entry is free
+    endpoint_locality_t locality;
+    char host[ENDPOINT_SIZE - 16];  // Of remote brokers, fits tcp://host:port
+    int port;                       // Of their first endpoint
+};
+
+pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+entry_t registry[ENDPOINT_REGISTRY_MAX];
+endpoint_transport_t default_transport = ENDPOINT_IPC;
+ENDPOINT_THREAD_LOCAL char thread_buf[ENDPOINT_SIZE];
+
+// Call with the registry locked
+entry_t* s_lookup(const char* name)
+{
+    for (int i = 0; i < ENDPOINT_REGISTRY_MAX; ++i)
+        if (registry[i].name[0] && strcmp(registry[i].name, name) == 0)
+            return &registry[i];
+    return 0;
+}
+
+// Endpoint number index of broker self, which is called xxx
+const char* s_resolve(const char* self, const char* xxx, int index,
+        char* buf)
+{
+    if (!buf)
+        buf = thread_buf;
+    endpoint_locality_t locality = default_transport == ENDPOINT_INPROC
+        ? ENDPOINT_PROCESS : ENDPOINT_HOST;
+    pthread_mutex_lock(&registry_mutex);
+    entry_t* entry = s_lookup(self);
+    if (entry) {
+        locality = entry->locality;
+        if (locality == ENDPOINT_REMOTE)
+            snprintf(buf, ENDPOINT_SIZE, "tcp://%s:%d", entry->host,
+                    entry->port + index);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    if (locality == ENDPOINT_PROCESS)
+        snprintf(buf, ENDPOINT_SIZE, "inproc://%s-%s", self, xxx);
+    else if (locality == ENDPOINT_HOST)
 #ifndef WIN32
-# define IMPLEMENT_ENDPOINT(xxx, tcp_port_prefix) \
-const char* xxx##_endpoint(const char* self, char* buf) \
-{ \
-    if (!buf) \
-        buf = endpoint_buf; \
-    sprintf(buf, "ipc:///tmp/%s-%s.ipc", self, #xxx); \
-    return buf; \
+        snprintf(buf, ENDPOINT_SIZE, "ipc:///tmp/%s-%s.ipc", self, xxx);
+#else  // ZeroMQ for Windows does not support IPC endpoints
+        snprintf(buf, ENDPOINT_SIZE, "tcp://127.0.0.1:%d%s", index, self);
+#endif // WIN32
+    return buf;
 }
-#else 
-# define IMPLEMENT_ENDPOINT(xxx, tcp_port_prefix) \
+
+}
+
+bool endpoint_register(const char* name, endpoint_locality_t locality,
+        const char* address)
+{
+    if (!name || !name[0] || strlen(name) >= sizeof(registry[0].name))
+        return false;
+    char host[sizeof(registry[0].host)] = "";
+    int port = 0;
+    if (locality == ENDPOINT_REMOTE) {
+        // The port follows the last colon, so [IPv6] addresses do too
+        const char* colon = address ? strrchr(address, ':') : 0;
+        if (!colon || colon == address
+                || colon - address >= (int)sizeof(host))
+            return false;
+        memcpy(host, address, colon - address);
+        host[colon - address] = 0;
+        port = atoi(colon + 1);
+        if (port <= 0 || port > 65536 - PORTS)
+            return false;
+    }
+
+    pthread_mutex_lock(&registry_mutex);
+    entry_t* entry = s_lookup(name);
+    for (int i = 0; !entry && i < ENDPOINT_REGISTRY_MAX; ++i)
+        if (!registry[i].name[0])
+            entry = &registry[i];
+    if (entry) {
+        strcpy(entry->name, name);
+        entry->locality = locality;
+        strcpy(entry->host, host);
+        entry->port = port;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return entry != 0;
+}
+
+void endpoint_unregister(const char* name)
+{
+    pthread_mutex_lock(&registry_mutex);
+    entry_t* entry = s_lookup(name);
+    if (entry)
+        entry->name[0] = 0;
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+void endpoint_set_transport(endpoint_transport_t transport)
+{
+    default_transport = transport;
+}
+
+#define IMPLEMENT_ENDPOINT(xxx, index) \
 const char* xxx##_endpoint(const char* self, char* buf) \
 { \
-    if (!buf) \
-        buf = endpoint_buf; \
-    sprintf(buf, "tcp://127.0.0.1:%d%s", tcp_port_prefix, self); \
-    return buf; \
+    return s_resolve(self, #xxx, index, buf); \
 }
-#endif // WIN32
 
 IMPLEMENT_ENDPOINT(state, 0)
 IMPLEMENT_ENDPOINT(localfe, 1)
 IMPLEMENT_ENDPOINT(localbe, 2)
 IMPLEMENT_ENDPOINT(cloud, 3)
 IMPLEMENT_ENDPOINT(monitor, 4)
+IMPLEMENT_ENDPOINT(gossip, 5)
@@ -3,6 +3,10 @@
 #ifndef CLUSTER_ENDPOINT_H_
 #define CLUSTER_ENDPOINT_H_
 
+// Endpoints are written to buf, of ENDPOINT_SIZE bytes, or without it to a
+// buffer of the calling thread's own, which its next call overwrites
+const int ENDPOINT_SIZE = 256;
+
 #define DECLARE_ENDPOINT(xxx) \
 const char* xxx##_endpoint(const char* self, char* buf = 0)
 
@@ -11,5 +15,36 @@ DECLARE_ENDPOINT(localfe);
 DECLARE_ENDPOINT(localbe);
 DECLARE_ENDPOINT(cloud);
 DECLARE_ENDPOINT(monitor);
+DECLARE_ENDPOINT(gossip);
+
+// Endpoints of a broker take the cheapest transport which reaches it, by
+// where the registry says it runs: inproc in this process, which keeps the
+// kernel out of the way, ipc on this host (tcp on Windows), tcp elsewhere.
+// Brokers register before any peer, or the broker itself, resolves their
+// endpoints; the registry is safe to use from any thread
+enum endpoint_locality_t {
+    ENDPOINT_PROCESS,       // Shares our context, see broker.h
+    ENDPOINT_HOST,
+    ENDPOINT_REMOTE
+};
+
+const int ENDPOINT_REGISTRY_MAX = 256;  // Brokers registered at once
+
+// Register broker name, remote ones at address "host:port", whose endpoints
+// take consecutive ports from port on; false if the registry is full or the
+// address is invalid. Registering a broker again moves it
+bool endpoint_register(const char* name, endpoint_locality_t locality,
+        const char* address = 0);
+void endpoint_unregister(const char* name);
+
+// Brokers not registered take the default transport, ipc (tcp on Windows)
+// for one broker per process. Inproc ones only connect brokers sharing a
+// context; set the transport before starting any of them
+enum endpoint_transport_t {
+    ENDPOINT_IPC,
+    ENDPOINT_INPROC
+};
+
+void endpoint_set_transport(endpoint_transport_t transport);
 
 #endif // CLUSTER_ENDPOINT_H_
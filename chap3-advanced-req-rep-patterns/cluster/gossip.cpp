@@ -0,0 +1,85 @@
+// cluster/gossip.cpp
+//
+#include "gossip.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace {
+
+const size_t FIELDS_SIZE = 2 + 8;   // Capacity and version of an entry
+
+size_t s_encode_entry(unsigned char* data, const char* name, size_t size,
+        int capacity, uint64_t version)
+{
+    if (capacity < 0)
+        capacity = 0;
+    if (capacity > 0xFFFF)
+        capacity = 0xFFFF;
+    data[0] = (unsigned char)size;
+    memcpy(data + 1, name, size);
+    data += 1 + size;
+    data[0] = (unsigned char)(capacity >> 8);
+    data[1] = (unsigned char)capacity;
+    for (int i = 0; i < 8; ++i)
+        data[2 + i] = (unsigned char)(version >> (56 - 8 * i));
+    return 1 + size + FIELDS_SIZE;
+}
+
+}
+
+int gossip_view_size(int nbr_peers)
+{
+    int size = 1;
+    while ((1 << (size - 1)) < nbr_peers)
+        size++;
+    return size < nbr_peers ? size : nbr_peers;
+}
+
+size_t gossip_encode(void* buf, const char* self, int capacity,
+        uint64_t version, peers_t* peers, uint64_t now)
+{
+    assert(buf);
+    assert(self);
+    assert(peers);
+    unsigned char* data = (unsigned char*)buf;
+    size_t size = s_encode_entry(data, self, strlen(self), capacity, version);
+    for (int i = 0; i < peers->size; ++i) {
+        peer_t* peer = &peers->items[i];
+        // Don't spread reports which expired here, or never came; nor
+        // tasks we routed to the peer since, which its next report counts
+        if (peer->version == 0 || now > peer->updated_at + peers->ttl)
+            continue;
+        size += s_encode_entry(data + size, peer->name, peer->name_size,
+                peer->reported, peer->version);
+    }
+    return size;
+}
+
+int gossip_merge(peers_t* peers, const char* self, const void* data,
+        size_t size, uint64_t now)
+{
+    assert(peers);
+    assert(self);
+    const unsigned char* bytes = (const unsigned char*)data;
+    int taken = 0;
+    while (size) {
+        size_t name_size = bytes[0];
+        if (size < 1 + name_size + FIELDS_SIZE)
+            return -1;
+        char name[PEER_NAME_MAX + 1];
+        memcpy(name, bytes + 1, name_size);
+        name[name_size] = 0;
+        const unsigned char* fields = bytes + 1 + name_size;
+        int capacity = (fields[0] << 8) | fields[1];
+        uint64_t version = 0;
+        for (int i = 0; i < 8; ++i)
+            version = (version << 8) | fields[2 + i];
+        if (strcmp(name, self) != 0
+                && peers_update_version(peers, name, capacity, version, now))
+            taken++;
+        bytes += 1 + name_size + FIELDS_SIZE;
+        size -= 1 + name_size + FIELDS_SIZE;
+    }
+    return taken;
+}
@@ -0,0 +1,40 @@
+// cluster/gossip.h
+//
+// Gossip, the alternative to broadcasting state to all peers. Each broker
+// talks to a small random view of its peers only, and now and then sends a
+// few of them the capacity of every broker it knows of: its own and what it
+// heard from others. Each broker numbers its reports, so the newest report
+// of each broker spreads through the cluster in a number of rounds which
+// grows with the log of the cluster size, while each broker keeps log N
+// connections instead of N. Numbers start from the time the broker started,
+// so the reports of a restarted broker are newer than those it made before.
+// A message is a vector of entries: the length of the broker's name in one
+// byte, the name, the capacity as 2 bytes then the version of the report as
+// 8 bytes, in network order.
+//
+#ifndef CLUSTER_GOSSIP_H_
+#define CLUSTER_GOSSIP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "peers.h"
+
+const uint64_t GOSSIP_INTERVAL = 100;   // msecs, between rounds
+const int GOSSIP_FANOUT = 2;            // Peers told per round
+const size_t GOSSIP_ENTRY_MAX = 1 + PEER_NAME_MAX + 2 + 8;
+const int GOSSIP_VIEW_MAX = 32;          // View of 2^31 peers
+
+// Size of the view of a broker with that many peers, log2 + 1
+int gossip_view_size(int nbr_peers);
+
+// Encode our report and the reports of peers still valid at time now into
+// buf, of (peers->size + 1) * GOSSIP_ENTRY_MAX bytes; returns its size
+size_t gossip_encode(void* buf, const char* self, int capacity,
+        uint64_t version, peers_t* peers, uint64_t now);
+// Take the reports of a message newer than ours at time now, skipping our
+// own; returns the number of reports taken, or -1 if the message is malformed
+int gossip_merge(peers_t* peers, const char* self, const void* data,
+        size_t size, uint64_t now);
+
+#endif // CLUSTER_GOSSIP_H_
@@ -0,0 +1,202 @@
+/**
+ * @file gossip_sim.cpp
+ *
+ * @breif Gossip convergence simulation
+ * Simulates state flow by gossip, see gossip.h, in rounds of GOSSIP_INTERVAL
+ * for clusters of growing size, and measures how many rounds it takes a new
+ * report of one broker to reach all the others. Brokers report again every
+ * STATE_INTERVAL, as the broker does; messages sent in a round arrive by the
+ * next one. Compares messages and connections with broadcasting each report
+ * to all peers.
+ *
+ *   gossip_sim [max brokers] [trials] [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gossip.h"
+#include "state.h"
+
+namespace {
+
+const int WARMUP_ROUNDS = 20;
+const int MAX_ROUNDS = 1000;
+const int REPORT_ROUNDS = (int)(STATE_INTERVAL / GOSSIP_INTERVAL);
+
+inline int randof(int n) { return rand() % n; }
+
+struct broker_t {
+    char name[16];
+    peers_t* peers;
+    int* view;
+    int view_size;
+    uint32_t version;
+    unsigned char* inbox;       // Messages received this round, back to back
+    size_t* inbox_sizes;
+    int nbr_inbox;
+};
+
+struct result_t {
+    double rounds;              // Average rounds to reach all brokers
+    int rounds_max;
+    double messages;            // Average messages sent meanwhile
+    double bytes;               // Average size of a message
+};
+
+void s_simulate(int nbr_brokers, int trials, result_t* result)
+{
+    memset(result, 0, sizeof(result_t));
+    size_t msg_max = nbr_brokers * GOSSIP_ENTRY_MAX;
+    int inbox_max = nbr_brokers * GOSSIP_FANOUT;
+    broker_t* brokers = (broker_t*)calloc(nbr_brokers, sizeof(broker_t));
+    for (int i = 0; i < nbr_brokers; ++i)
+        sprintf(brokers[i].name, "g%d", i);
+    for (int i = 0; i < nbr_brokers; ++i) {
+        broker_t* broker = &brokers[i];
+        broker->peers = peers_new();
+        int* others = (int*)malloc((nbr_brokers - 1) * sizeof(int));
+        int nbr_others = 0;
+        for (int j = 0; j < nbr_brokers; ++j) {
+            if (j != i) {
+                peers_add(broker->peers, brokers[j].name);
+                others[nbr_others++] = j;
+            }
+        }
+        // Random view, as the broker picks it
+        broker->view_size = gossip_view_size(nbr_others);
+        broker->view = (int*)malloc(broker->view_size * sizeof(int));
+        for (int v = 0; v < broker->view_size; ++v) {
+            int j = v + randof(nbr_others - v);
+            broker->view[v] = others[j];
+            others[j] = others[v];
+        }
+        free(others);
+        broker->inbox = (unsigned char*)malloc(inbox_max * msg_max);
+        broker->inbox_sizes = (size_t*)malloc(inbox_max * sizeof(size_t));
+    }
+
+    unsigned char* msg = (unsigned char*)malloc(msg_max);
+    long messages = 0;
+    double bytes = 0;
+    int round = 0;
+    int trial = -1;
+    int origin = 0;
+    uint32_t target = 0;        // Version of origin's report being traced
+    int trial_start = 0;
+    long trial_messages = 0;
+    while (trial < trials && round < WARMUP_ROUNDS + trials * MAX_ROUNDS) {
+        uint64_t now = (uint64_t)round * GOSSIP_INTERVAL;
+        // Start tracing a new report once the last one reached everybody
+        if (round >= WARMUP_ROUNDS && trial_start <= round && target == 0) {
+            trial++;
+            if (trial == trials)
+                break;
+            origin = randof(nbr_brokers);
+            target = ++brokers[origin].version;
+            trial_start = round;
+            trial_messages = messages;
+        }
+        // Deliver messages of the last round
+        for (int i = 0; i < nbr_brokers; ++i) {
+            broker_t* broker = &brokers[i];
+            unsigned char* data = broker->inbox;
+            for (int m = 0; m < broker->nbr_inbox; ++m) {
+                gossip_merge(broker->peers, broker->name, data,
+                        broker->inbox_sizes[m], now);
+                data += broker->inbox_sizes[m];
+            }
+            broker->nbr_inbox = 0;
+        }
+        // Has the traced report reached everybody?
+        if (target) {
+            int reached = 0;
+            for (int i = 0; i < nbr_brokers; ++i) {
+                if (i == origin)
+                    continue;
+                peer_t* peer = peers_lookup(brokers[i].peers,
+                        brokers[origin].name, strlen(brokers[origin].name));
+                if (peer->version >= target)
+                    reached++;
+            }
+            if (reached == nbr_brokers - 1) {
+                int rounds = round - trial_start;
+                result->rounds += rounds;
+                if (rounds > result->rounds_max)
+                    result->rounds_max = rounds;
+                result->messages += messages - trial_messages;
+                target = 0;
+                continue;   // Next trial starts this round
+            }
+        }
+        // Gossip round; brokers report again now and then
+        for (int i = 0; i < nbr_brokers; ++i) {
+            broker_t* broker = &brokers[i];
+            if ((round + i) % REPORT_ROUNDS == 0)
+                broker->version++;
+            size_t size = gossip_encode(msg, broker->name, 1,
+                    broker->version, broker->peers, now);
+            for (int f = 0; f < GOSSIP_FANOUT && f < broker->view_size;
+                    ++f) {
+                int v = f + randof(broker->view_size - f);
+                int peer_index = broker->view[v];
+                broker->view[v] = broker->view[f];
+                broker->view[f] = peer_index;
+                broker_t* peer = &brokers[peer_index];
+                unsigned char* data = peer->inbox;
+                for (int m = 0; m < peer->nbr_inbox; ++m)
+                    data += peer->inbox_sizes[m];
+                memcpy(data, msg, size);
+                peer->inbox_sizes[peer->nbr_inbox++] = size;
+                messages++;
+                bytes += size;
+            }
+        }
+        round++;
+    }
+    int done = trial < trials ? trial : trials;
+    if (done > 0) {
+        result->rounds /= done;
+        result->messages /= done;
+    }
+    result->bytes = messages ? bytes / messages : 0;
+
+    for (int i = 0; i < nbr_brokers; ++i) {
+        peers_destroy(&brokers[i].peers);
+        free(brokers[i].view);
+        free(brokers[i].inbox);
+        free(brokers[i].inbox_sizes);
+    }
+    free(brokers);
+    free(msg);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int max_brokers = argc > 1 ? atoi(argv[1]) : 256;
+    int trials = argc > 2 ? atoi(argv[2]) : 20;
+    unsigned int seed = argc > 3 ? (unsigned int)atoi(argv[3]) : 1;
+    if (max_brokers < 4 || trials < 1) {
+        printf("syntax: gossip_sim [max brokers] [trials] [seed]\n");
+        return 0;
+    }
+    srand(seed);
+
+    printf("fanout %d, a round every %dms, %d trials\n", GOSSIP_FANOUT,
+            (int)GOSSIP_INTERVAL, trials);
+    printf("%8s %6s %8s %8s %10s %10s %10s %12s %12s\n", "brokers", "view",
+            "rounds", "max", "time", "messages", "msg size", "connections",
+            "broadcast");
+    for (int n = 4; n <= max_brokers; n *= 2) {
+        result_t result;
+        s_simulate(n, trials, &result);
+        // Broadcast takes one message per peer, n - 1 connections per broker
+        printf("%8d %6d %8.1f %8d %8.0fms %10.0f %9.0fB %12d %12d\n", n,
+                gossip_view_size(n - 1), result.rounds, result.rounds_max,
+                result.rounds * GOSSIP_INTERVAL, result.messages, result.bytes,
+                n * gossip_view_size(n - 1), n * (n - 1));
+    }
+    return 0;
+}
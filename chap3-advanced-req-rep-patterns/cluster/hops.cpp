@@ -0,0 +1,80 @@
+// cluster/hops.cpp
+//
+#include "hops.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace {  // Internal
+
+void s_add(hops_t* self, const char* name)
+{
+    assert(self->nbr_visited < HOPS_MAX);
+    assert(strlen(name) <= (size_t)PEER_NAME_MAX);
+    char* visited = self->visited[self->nbr_visited];
+    strcpy(visited, name);
+    self->names[self->nbr_visited++] = visited;
+}
+
+}
+
+void hops_init(hops_t* self, const char* name, int max_hops)
+{
+    assert(self);
+    assert(name);
+    if (max_hops > HOPS_MAX - 1)
+        max_hops = HOPS_MAX - 1;
+    self->ttl = max_hops - 1;   // Taking the first hop now
+    self->nbr_visited = 0;
+    s_add(self, name);
+}
+
+size_t hops_encode(void* buf, const hops_t* self)
+{
+    assert(buf);
+    assert(self);
+    unsigned char* data = (unsigned char*)buf;
+    data[0] = HOPS_MARKER;
+    data[1] = (unsigned char)self->ttl;
+    data[2] = (unsigned char)self->nbr_visited;
+    size_t size = 3;
+    for (int i = 0; i < self->nbr_visited; ++i) {
+        size_t name_size = strlen(self->visited[i]);
+        data[size] = (unsigned char)name_size;
+        memcpy(data + size + 1, self->visited[i], name_size);
+        size += 1 + name_size;
+    }
+    return size;
+}
+
+bool hops_decode(const void* data, size_t size, hops_t* self)
+{
+    assert(self);
+    const unsigned char* bytes = (const unsigned char*)data;
+    if (size < 3 || bytes[0] != HOPS_MARKER || bytes[2] > HOPS_MAX)
+        return false;
+    self->ttl = bytes[1];
+    self->nbr_visited = 0;
+    size_t offset = 3;
+    for (int i = 0; i < bytes[2]; ++i) {
+        if (offset >= size || offset + 1 + bytes[offset] > size)
+            return false;
+        size_t name_size = bytes[offset];
+        char* visited = self->visited[self->nbr_visited];
+        memcpy(visited, bytes + offset + 1, name_size);
+        visited[name_size] = 0;
+        self->names[self->nbr_visited++] = visited;
+        offset += 1 + name_size;
+    }
+    return offset == size;
+}
+
+bool hops_visit(hops_t* self, const char* name)
+{
+    assert(self);
+    if (self->ttl <= 0 || self->nbr_visited == HOPS_MAX)
+        return false;
+    self->ttl--;
+    s_add(self, name);
+    return true;
+}
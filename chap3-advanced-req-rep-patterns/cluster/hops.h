@@ -0,0 +1,42 @@
+// cluster/hops.h
+//
+// Hops frame of a task which may go through several peers, for clusters
+// where brokers only connect to some of the others. The broker which sends a
+// task to the cloud adds the frame, directly after the delimiter of the
+// client's envelope, and the peer which serves the task takes it off; a peer
+// which can't serve the task passes it on to one of its own peers, which
+// hasn't seen it yet, while the task has hops left. A frame is the marker
+// byte, the hops left, the number of brokers the task went through, then the
+// name of each of them as in state messages: the length of the name in one
+// byte, and the name.
+//
+#ifndef CLUSTER_HOPS_H_
+#define CLUSTER_HOPS_H_
+
+#include <stddef.h>
+
+#include "peers.h"
+
+const int HOPS_MAX = 16;                // Brokers a task may go through
+const unsigned char HOPS_MARKER = 'H';
+const size_t HOPS_MSG_MAX = 3 + HOPS_MAX * (1 + PEER_NAME_MAX);
+
+struct hops_t {
+    int ttl;                // Peers the task may still be passed on to
+    int nbr_visited;
+    char visited[HOPS_MAX][PEER_NAME_MAX + 1];
+    const char* names[HOPS_MAX];  // Of visited, for peers_select
+};
+
+// Start hops of a task from broker self, which may go through up to
+// max_hops peers
+void hops_init(hops_t* self, const char* name, int max_hops);
+// Encode hops into buf, of HOPS_MSG_MAX bytes, returns its size
+size_t hops_encode(void* buf, const hops_t* self);
+// Decode a hops frame; returns false if it's not one
+bool hops_decode(const void* data, size_t size, hops_t* self);
+// Broker passes the task on to a peer, takes one hop; returns false if it
+// has none left
+bool hops_visit(hops_t* self, const char* name);
+
+#endif // CLUSTER_HOPS_H_
@@ -0,0 +1,191 @@
+// cluster/metrics.cpp
+//
+#include "metrics.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {  // Internal
+
+void s_put64(unsigned char* data, int64_t value)
+{
+    for (int i = 7; i >= 0; --i) {
+        data[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+int64_t s_get64(const unsigned char* data)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+        value = (value << 8) | data[i];
+    return (int64_t)value;
+}
+
+int s_compare(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Percentile of sorted values
+int64_t s_percentile(const int64_t* values, int nbr_values, int percent)
+{
+    return nbr_values ? values[(int64_t)nbr_values * percent / 100] : 0;
+}
+
+}
+
+void metrics_encode(void* buf, const metrics_t* metrics)
+{
+    assert(buf);
+    assert(metrics);
+    unsigned char* data = (unsigned char*)buf;
+    memset(data, 0, METRICS_TASK_ID_MAX);
+    size_t size = strlen(metrics->task_id);
+    assert(size <= METRICS_TASK_ID_MAX);
+    memcpy(data, metrics->task_id, size);
+    data += METRICS_TASK_ID_MAX;
+    s_put64(data, metrics->enqueued_at);
+    s_put64(data + 8, metrics->dequeued_at);
+    s_put64(data + 16, metrics->completed_at);
+    data[24] = (unsigned char)metrics->path;
+}
+
+bool metrics_decode(const void* data, size_t size, metrics_t* metrics)
+{
+    assert(metrics);
+    const unsigned char* bytes = (const unsigned char*)data;
+    if (size != METRICS_MSG_SIZE
+            || bytes[METRICS_MSG_SIZE - 1] >= METRICS_PATHS)
+        return false;
+    memcpy(metrics->task_id, bytes, METRICS_TASK_ID_MAX);
+    metrics->task_id[METRICS_TASK_ID_MAX] = 0;
+    bytes += METRICS_TASK_ID_MAX;
+    metrics->enqueued_at = s_get64(bytes);
+    metrics->dequeued_at = s_get64(bytes + 8);
+    metrics->completed_at = s_get64(bytes + 16);
+    metrics->path = (metrics_path_t)bytes[24];
+    return true;
+}
+
+void metrics_stamp_encode(void* buf, int64_t dispatched_at,
+        metrics_path_t path)
+{
+    assert(buf);
+    unsigned char* data = (unsigned char*)buf;
+    s_put64(data, dispatched_at);
+    data[8] = (unsigned char)path;
+}
+
+bool metrics_stamp_decode(const void* data, size_t size,
+        int64_t* dispatched_at, metrics_path_t* path)
+{
+    assert(dispatched_at);
+    assert(path);
+    const unsigned char* bytes = (const unsigned char*)data;
+    if (size != METRICS_STAMP_SIZE || bytes[8] > METRICS_CLOUD)
+        return false;
+    *dispatched_at = s_get64(bytes);
+    *path = (metrics_path_t)bytes[8];
+    return true;
+}
+
+metrics_agg_t* metrics_agg_new()
+{
+    metrics_agg_t* self = (metrics_agg_t*)calloc(1, sizeof(metrics_agg_t));
+    assert(self);
+    return self;
+}
+
+void metrics_agg_destroy(metrics_agg_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        free(*self_p);
+        *self_p = 0;
+    }
+}
+
+void metrics_agg_add(metrics_agg_t* self, const metrics_t* metrics)
+{
+    assert(self);
+    assert(metrics);
+    int64_t second = metrics->completed_at / 1000000;
+    metrics_second_t* slot = &self->seconds[second % METRICS_WINDOW];
+    if (slot->second != second) {
+        if (slot->second > second)
+            return;     // Older than the window
+        memset(slot, 0, sizeof(metrics_second_t));
+        slot->second = second;
+    }
+    slot->done[metrics->path]++;
+    if (metrics->path == METRICS_LOST)
+        return;
+    // Keep a uniform sample of the second's latencies, once it has more
+    // tasks than we keep
+    int done = slot->done[METRICS_LOCAL] + slot->done[METRICS_CLOUD]
+        + slot->done[METRICS_DIRECT];
+    int i = done <= METRICS_SAMPLES ? done - 1 : rand() % done;
+    if (i >= METRICS_SAMPLES)
+        return;
+    slot->latencies[i] = metrics->completed_at - metrics->enqueued_at;
+    slot->waits[i] = metrics->dequeued_at - metrics->enqueued_at;
+    if (done <= METRICS_SAMPLES)
+        slot->nbr_samples = done;
+}
+
+void metrics_agg_report(metrics_agg_t* self, int64_t now, int seconds,
+        metrics_report_t* report)
+{
+    assert(self);
+    assert(report);
+    memset(report, 0, sizeof(metrics_report_t));
+    if (seconds > METRICS_WINDOW)
+        seconds = METRICS_WINDOW;
+    if (seconds < 1)
+        return;
+    report->seconds = seconds;
+
+    // Seconds may have sampled more or fewer of their tasks; percentiles are
+    // over what they kept
+    int64_t* latencies =
+        (int64_t*)malloc(seconds * METRICS_SAMPLES * sizeof(int64_t));
+    int64_t* waits =
+        (int64_t*)malloc(seconds * METRICS_SAMPLES * sizeof(int64_t));
+    assert(latencies && waits);
+    int nbr_samples = 0;
+    int done[METRICS_PATHS] = { 0 };
+    int64_t current = now / 1000000;
+    for (int64_t second = current - seconds; second < current; ++second) {
+        metrics_second_t* slot = &self->seconds[second % METRICS_WINDOW];
+        if (slot->second != second)
+            continue;
+        for (int p = 0; p < METRICS_PATHS; ++p)
+            done[p] += slot->done[p];
+        memcpy(latencies + nbr_samples, slot->latencies,
+                slot->nbr_samples * sizeof(int64_t));
+        memcpy(waits + nbr_samples, slot->waits,
+                slot->nbr_samples * sizeof(int64_t));
+        nbr_samples += slot->nbr_samples;
+    }
+    qsort(latencies, nbr_samples, sizeof(int64_t), s_compare);
+    qsort(waits, nbr_samples, sizeof(int64_t), s_compare);
+
+    int served = done[METRICS_LOCAL] + done[METRICS_CLOUD]
+        + done[METRICS_DIRECT];
+    report->throughput = (double)served / seconds;
+    report->cloud = served ? (double)done[METRICS_CLOUD] / served : 0;
+    report->direct = served ? (double)done[METRICS_DIRECT] / served : 0;
+    report->lost = done[METRICS_LOST];
+    report->latency_p50 = s_percentile(latencies, nbr_samples, 50);
+    report->latency_p95 = s_percentile(latencies, nbr_samples, 95);
+    report->latency_p99 = s_percentile(latencies, nbr_samples, 99);
+    report->wait_p50 = s_percentile(waits, nbr_samples, 50);
+    report->wait_p99 = s_percentile(waits, nbr_samples, 99);
+    free(latencies);
+    free(waits);
+}
@@ -0,0 +1,88 @@
+// cluster/metrics.h
+//
+// Metrics clients push to the monitor of their broker, one per task, and the
+// aggregator the monitor keeps them in.
+// The router stamps each task it dispatches with the time and the path it
+// took, local or cloud; workers send the stamps back with the reply, so that
+// the client knows when its task was queued, taken and done. A metrics
+// message has a fixed layout: the task id, zero padded, the three times in
+// usecs as 8 bytes each, then the path in one byte, all in network order.
+// The aggregator keeps a second by second account of the last few seconds:
+// how many tasks were done, by which path, and a sample of their latencies.
+//
+#ifndef CLUSTER_METRICS_H_
+#define CLUSTER_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t METRICS_TASK_ID_MAX = 32;
+const size_t METRICS_MSG_SIZE = METRICS_TASK_ID_MAX + 3 * 8 + 1;
+const size_t METRICS_STAMP_SIZE = 8 + 1;
+const int METRICS_WINDOW = 10;          // Seconds the aggregator keeps
+const int METRICS_SAMPLES = 1024;       // Latencies it keeps per second
+
+enum metrics_path_t {
+    METRICS_LOCAL,          // Served by a worker of the client's broker
+    METRICS_CLOUD,          // Served by a peer's
+    METRICS_LOST,           // Client gave up on it
+    METRICS_DIRECT,         // Sent straight to a peer by the client, see
+                            // direct.h
+    METRICS_PATHS
+};
+
+struct metrics_t {
+    char task_id[METRICS_TASK_ID_MAX + 1];
+    int64_t enqueued_at;    // usecs, client sent the task
+    int64_t dequeued_at;    // usecs, router dispatched it to a worker
+    int64_t completed_at;   // usecs, client got the reply, or gave up
+    metrics_path_t path;
+};
+
+// Encode metrics into buf, of METRICS_MSG_SIZE bytes
+void metrics_encode(void* buf, const metrics_t* metrics);
+// Decode a metrics message; returns false if it's malformed
+bool metrics_decode(const void* data, size_t size, metrics_t* metrics);
+
+// Encode a stamp of the router into buf, of METRICS_STAMP_SIZE bytes
+void metrics_stamp_encode(void* buf, int64_t dispatched_at,
+        metrics_path_t path);
+// Decode a stamp; returns false if it's not one
+bool metrics_stamp_decode(const void* data, size_t size,
+        int64_t* dispatched_at, metrics_path_t* path);
+
+struct metrics_second_t {
+    int64_t second;         // Since the epoch, 0 if unused
+    int done[METRICS_PATHS];  // Tasks by path
+    int nbr_samples;
+    int64_t latencies[METRICS_SAMPLES];  // usecs, enqueued to completed
+    int64_t waits[METRICS_SAMPLES];      // usecs, enqueued to dequeued
+};
+
+struct metrics_agg_t {
+    metrics_second_t seconds[METRICS_WINDOW];
+};
+
+struct metrics_report_t {
+    int seconds;            // Reported on, with tasks or not
+    double throughput;      // Tasks done per second
+    double cloud;           // Share of tasks routed to peers by brokers
+    double direct;          // Share of tasks sent to peers by clients
+    int lost;
+    int64_t latency_p50;    // usecs
+    int64_t latency_p95;
+    int64_t latency_p99;
+    int64_t wait_p50;       // usecs
+    int64_t wait_p99;
+};
+
+metrics_agg_t* metrics_agg_new();
+void metrics_agg_destroy(metrics_agg_t** self_p);
+// Take the metrics of a task, by the second it completed in
+void metrics_agg_add(metrics_agg_t* self, const metrics_t* metrics);
+// Report on the last seconds, up to METRICS_WINDOW, which completed before
+// time now, in usecs
+void metrics_agg_report(metrics_agg_t* self, int64_t now, int seconds,
+        metrics_report_t* report);
+
+#endif // CLUSTER_METRICS_H_
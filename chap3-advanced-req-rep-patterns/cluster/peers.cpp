@@ -0,0 +1,247 @@
+// cluster/peers.cpp
+//
+#include "peers.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* PEER_POLICY_NAMES[PEER_POLICY_COUNT] = {
+    "random", "weighted", "p2c", "lro"
+};
+
+namespace {
+
+// FNV-1a
+uint32_t s_hash(const void* name, size_t size)
+{
+    const unsigned char* data = (const unsigned char*)name;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+void s_index(peers_t* self, int item)
+{
+    peer_t* peer = &self->items[item];
+    int mask = self->index_size - 1;
+    int slot = s_hash(peer->name, peer->name_size) & mask;
+    while (self->index[slot])
+        slot = (slot + 1) & mask;
+    self->index[slot] = item + 1;
+}
+
+void s_update(peer_t* peer, int capacity, uint64_t now)
+{
+    peer->capacity = capacity < 0 ? 0 : capacity;
+    peer->reported = peer->capacity;
+    peer->updated_at = now;
+    if (peer->capacity == 0)
+        peer->overloaded_at = now;
+}
+
+}
+
+peers_t* peers_new(uint64_t ttl)
+{
+    peers_t* self = (peers_t*)calloc(1, sizeof(peers_t));
+    assert(self);
+    self->ttl = ttl;
+    return self;
+}
+
+void peers_destroy(peers_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        peers_t* self = *self_p;
+        free(self->items);
+        free(self->index);
+        free(self->candidates);
+        free(self);
+        *self_p = 0;
+    }
+}
+
+peer_t* peers_add(peers_t* self, const char* name)
+{
+    assert(self);
+    assert(name);
+    size_t size = strlen(name);
+    assert(size <= (size_t)PEER_NAME_MAX);
+    peer_t* peer = peers_lookup(self, name, size);
+    if (peer)
+        return peer;
+
+    if (self->size == self->max_size) {
+        self->max_size = self->max_size ? self->max_size * 2 : 16;
+        self->items = (peer_t*)realloc(self->items,
+                self->max_size * sizeof(peer_t));
+        self->candidates = (peer_t**)realloc(self->candidates,
+                self->max_size * sizeof(peer_t*));
+        assert(self->items && self->candidates);
+        // Rehash into an index twice the size, to keep probes short
+        free(self->index);
+        self->index_size = self->max_size * 2;
+        self->index = (int*)calloc(self->index_size, sizeof(int));
+        assert(self->index);
+        for (int i = 0; i < self->size; ++i)
+            s_index(self, i);
+    }
+    peer = &self->items[self->size++];
+    memset(peer, 0, sizeof(peer_t));
+    memcpy(peer->name, name, size);
+    peer->name_size = size;
+    peer->capacity = -1;
+    peer->reported = -1;
+    s_index(self, self->size - 1);
+    return peer;
+}
+
+bool peers_remove(peers_t* self, const char* name)
+{
+    assert(self);
+    peer_t* peer = peers_lookup(self, name, strlen(name));
+    if (!peer)
+        return false;
+    // Move the last peer into its place, and index all of them again
+    *peer = self->items[--self->size];
+    memset(self->index, 0, self->index_size * sizeof(int));
+    for (int i = 0; i < self->size; ++i)
+        s_index(self, i);
+    return true;
+}
+
+peer_t* peers_lookup(peers_t* self, const void* name, size_t size)
+{
+    assert(self);
+    if (!self->index)
+        return 0;
+    int mask = self->index_size - 1;
+    for (int slot = s_hash(name, size) & mask; self->index[slot];
+            slot = (slot + 1) & mask) {
+        peer_t* peer = &self->items[self->index[slot] - 1];
+        if (peer->name_size == size && memcmp(peer->name, name, size) == 0)
+            return peer;
+    }
+    return 0;
+}
+
+bool peers_update(peers_t* self, const char* name, int capacity,
+        uint64_t now)
+{
+    assert(self);
+    peer_t* peer = peers_lookup(self, name, strlen(name));
+    if (!peer)
+        return false;
+    s_update(peer, capacity, now);
+    return true;
+}
+
+bool peers_update_version(peers_t* self, const char* name, int capacity,
+        uint64_t version, uint64_t now)
+{
+    assert(self);
+    peer_t* peer = peers_lookup(self, name, strlen(name));
+    if (!peer || version <= peer->version)
+        return false;
+    peer->version = version;
+    s_update(peer, capacity, now);
+    return true;
+}
+
+int peers_spare_of(peers_t* self, peer_t* peer, uint64_t now)
+{
+    assert(self);
+    assert(peer);
+    if (peer->capacity <= 0 || now > peer->updated_at + self->ttl)
+        return 0;
+    return peer->capacity;
+}
+
+int peers_spare(peers_t* self, uint64_t now)
+{
+    assert(self);
+    int spare = 0;
+    for (int i = 0; i < self->size; ++i)
+        spare += peers_spare_of(self, &self->items[i], now);
+    return spare;
+}
+
+peer_t* peers_select(peers_t* self, uint64_t now, peer_policy_t policy,
+        const char* const* except, int nbr_except)
+{
+    assert(self);
+    int size = 0;
+    int spare = 0;
+    for (int i = 0; i < self->size; ++i) {
+        peer_t* peer = &self->items[i];
+        int peer_spare = peers_spare_of(self, peer, now);
+        for (int j = 0; j < nbr_except && peer_spare > 0; ++j) {
+            if (strcmp(peer->name, except[j]) == 0)
+                peer_spare = 0;
+        }
+        if (peer_spare > 0) {
+            self->candidates[size++] = peer;
+            spare += peer_spare;
+        }
+    }
+    if (size == 0)
+        return 0;
+
+    peer_t* selected = self->candidates[rand() % size];
+    switch (policy) {
+    case PEER_POLICY_WEIGHTED: {
+        int ticket = rand() % spare;
+        for (int i = 0; i < size; ++i) {
+            ticket -= peers_spare_of(self, self->candidates[i], now);
+            if (ticket < 0) {
+                selected = self->candidates[i];
+                break;
+            }
+        }
+        break;
+    }
+    case PEER_POLICY_P2C: {
+        peer_t* other = self->candidates[rand() % size];
+        if (peers_spare_of(self, other, now)
+                > peers_spare_of(self, selected, now))
+            selected = other;
+        break;
+    }
+    case PEER_POLICY_LRO:
+        // Oldest overload first, then most spare capacity
+        for (int i = 0; i < size; ++i) {
+            peer_t* peer = self->candidates[i];
+            if (peer->overloaded_at < selected->overloaded_at
+                    || (peer->overloaded_at == selected->overloaded_at
+                        && peers_spare_of(self, peer, now)
+                            > peers_spare_of(self, selected, now)))
+                selected = peer;
+        }
+        break;
+    default:
+        break;
+    }
+    return selected;
+}
+
+void peers_routed(peers_t* self, peer_t* peer, uint64_t now)
+{
+    assert(self);
+    assert(peer);
+    if (peer->capacity > 0 && --peer->capacity == 0)
+        peer->overloaded_at = now;
+}
+
+bool peers_policy_parse(const char* name, peer_policy_t* policy)
+{
+    for (int i = 0; i < PEER_POLICY_COUNT; ++i) {
+        if (strcmp(name, PEER_POLICY_NAMES[i]) == 0) {
+            *policy = (peer_policy_t)i;
+            return true;
+        }
+    }
+    return false;
+}
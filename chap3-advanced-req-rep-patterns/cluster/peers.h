@@ -0,0 +1,89 @@
+// cluster/peers.h
+//
+// Table of peer brokers and the spare capacity each one last reported.
+// A report is trusted for a limited time only; after that the peer's
+// capacity is unknown again, and no task is routed to it until it reports.
+//
+#ifndef CLUSTER_PEERS_H_
+#define CLUSTER_PEERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+const int PEER_NAME_MAX = 255;          // ZeroMQ limit for identities
+const uint64_t PEER_STATE_TTL = 3000;   // msecs, default trust in a report
+
+// How to pick one of the peers with spare capacity
+enum peer_policy_t {
+    PEER_POLICY_RANDOM,     // Any of them
+    PEER_POLICY_WEIGHTED,   // At random, weighted by spare capacity
+    PEER_POLICY_P2C,        // The one with more spare capacity of two random
+    PEER_POLICY_LRO,        // The least recently overloaded
+    PEER_POLICY_COUNT
+};
+extern const char* PEER_POLICY_NAMES[PEER_POLICY_COUNT];
+
+struct peer_t {
+    char name[PEER_NAME_MAX + 1];
+    size_t name_size;
+    int capacity;           // Spare capacity, as reported minus tasks routed
+                            // to peer since, -1 until it reports
+    int reported;           // Spare capacity, as reported, which is what
+                            // gossip relays
+    uint64_t updated_at;    // Reported at this time, msecs
+    uint64_t overloaded_at; // Last seen with no spare capacity, msecs
+    uint64_t version;       // Of the report, by the peer, 0 before any
+    uint64_t heard_at;      // Last beacon of peer, msecs, 0 if it was
+                            // configured rather than discovered
+};
+
+struct peers_t {
+    peer_t* items;
+    int size;
+    int max_size;
+    int* index;             // Open addressing hash of names, item index + 1,
+    int index_size;         // 0 for a free slot; twice max_size, a power of 2
+    uint64_t ttl;           // Reports expire after this time, msecs
+    peer_t** candidates;    // Scratch space for peers_select
+};
+
+peers_t* peers_new(uint64_t ttl = PEER_STATE_TTL);
+void peers_destroy(peers_t** self_p);
+
+// Add a peer, its capacity unknown until it reports
+peer_t* peers_add(peers_t* self, const char* name);
+// Remove a peer, returns false if it's not ours. Invalidates pointers to
+// peers
+bool peers_remove(peers_t* self, const char* name);
+// Peer with specified name, or null if it's not ours; takes the same time
+// however many peers there are, as replies are routed by this
+peer_t* peers_lookup(peers_t* self, const void* name, size_t size);
+// Take the capacity a peer reported at time now, returns false if the peer
+// is not ours
+bool peers_update(peers_t* self, const char* name, int capacity,
+        uint64_t now);
+
+// Take the capacity a peer reported at time now, if its version is newer than
+// the one we have; returns false if it's not, or the peer is not ours. Peers
+// count their reports, so reports relayed by others can be told from old ones
+bool peers_update_version(peers_t* self, const char* name, int capacity,
+        uint64_t version, uint64_t now);
+
+// Spare capacity of a peer at time now, 0 if unknown or expired
+int peers_spare_of(peers_t* self, peer_t* peer, uint64_t now);
+// Total spare capacity of all peers at time now
+int peers_spare(peers_t* self, uint64_t now);
+// Pick a peer with spare capacity at time now according to policy, or null
+// if none has any; none of the except peers, which a task went through
+// already
+peer_t* peers_select(peers_t* self, uint64_t now,
+        peer_policy_t policy = PEER_POLICY_RANDOM,
+        const char* const* except = 0, int nbr_except = 0);
+// Count a task routed to the peer at time now against its spare capacity,
+// until it reports again
+void peers_routed(peers_t* self, peer_t* peer, uint64_t now);
+
+// Policy with specified name, returns false if there is none
+bool peers_policy_parse(const char* name, peer_policy_t* policy);
+
+#endif // CLUSTER_PEERS_H_
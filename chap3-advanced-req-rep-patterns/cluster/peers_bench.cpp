@@ -0,0 +1,110 @@
+/**
+ * @file peers_bench.cpp
+ *
+ * @breif Reply routing benchmark
+ * Times how the broker tells replies for peer brokers from replies for its own
+ * clients, by the identity in their first frame:
+ *  - scan, strlen and memcmp against each peer name, as task_flow.cpp did
+ *  - hash, peers_lookup, see peers.h
+ * Half of the replies go to peers, the others to clients, whose identities
+ * are the 5 bytes ZeroMQ generates.
+ *
+ *   peers_bench [peers] [lookups]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "peers.h"
+
+namespace {
+
+const int NBR_IDENTITIES = 1024;
+
+struct identity_t {
+    char data[PEER_NAME_MAX + 1];
+    size_t size;
+};
+
+int64_t s_usecs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+bool s_scan(char** names, int nbr_names, const void* data, size_t size)
+{
+    for (int i = 0; i < nbr_names; ++i) {
+        if (size == strlen(names[i]) && memcmp(data, names[i], size) == 0)
+            return true;
+    }
+    return false;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int nbr_peers = argc > 1 ? atoi(argv[1]) : 64;
+    long lookups = argc > 2 ? atol(argv[2]) : 10000000;
+    if (nbr_peers < 1 || lookups < 1) {
+        printf("syntax: peers_bench [peers] [lookups]\n");
+        return 0;
+    }
+    srand(1);
+
+    char** names = (char**)malloc(nbr_peers * sizeof(char*));
+    peers_t* peers = peers_new();
+    for (int i = 0; i < nbr_peers; ++i) {
+        names[i] = (char*)malloc(32);
+        sprintf(names[i], "broker-%d", i);
+        peers_add(peers, names[i]);
+    }
+    identity_t* identities =
+        (identity_t*)malloc(NBR_IDENTITIES * sizeof(identity_t));
+    int expected = 0;
+    for (int i = 0; i < NBR_IDENTITIES; ++i) {
+        identity_t* identity = &identities[i];
+        if (i % 2) {
+            strcpy(identity->data, names[rand() % nbr_peers]);
+            identity->size = strlen(identity->data);
+            expected++;
+        } else {
+            identity->data[0] = 0;
+            for (int j = 1; j < 5; ++j)
+                identity->data[j] = (char)rand();
+            identity->size = 5;
+        }
+    }
+    expected = (int)(lookups / NBR_IDENTITIES * expected);
+    lookups = lookups / NBR_IDENTITIES * NBR_IDENTITIES;
+
+    printf("%d peers, %ld lookups\n", nbr_peers, lookups);
+    for (int method = 0; method < 2; ++method) {
+        int64_t start = s_usecs();
+        int found = 0;
+        for (long i = 0; i < lookups; ++i) {
+            identity_t* identity = &identities[i % NBR_IDENTITIES];
+            if (method == 0)
+                found += s_scan(names, nbr_peers, identity->data,
+                        identity->size);
+            else
+                found += peers_lookup(peers, identity->data,
+                        identity->size) != 0;
+        }
+        int64_t elapsed = s_usecs() - start;
+        printf("%-5s %8.1f ns/lookup%s\n", method == 0 ? "scan" : "hash",
+                1000.0 * elapsed / lookups,
+                found == expected ? "" : ", wrong results");
+    }
+
+    for (int i = 0; i < nbr_peers; ++i)
+        free(names[i]);
+    free(names);
+    free(identities);
+    peers_destroy(&peers);
+    return 0;
+}
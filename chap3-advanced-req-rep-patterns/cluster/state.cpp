@@ -0,0 +1,93 @@
+// cluster/state.cpp
+//
+#include "state.h"
+
+#include <assert.h>
+#include <string.h>
+
+size_t state_encode(void* buf, const char* name, int capacity)
+{
+    assert(buf);
+    assert(name);
+    size_t size = strlen(name);
+    assert(size <= (size_t)PEER_NAME_MAX);
+    if (capacity < 0)
+        capacity = 0;
+    if (capacity > 0xFFFF)
+        capacity = 0xFFFF;
+    unsigned char* data = (unsigned char*)buf;
+    data[0] = (unsigned char)size;
+    memcpy(data + 1, name, size);
+    data[1 + size] = (unsigned char)(capacity >> 8);
+    data[2 + size] = (unsigned char)capacity;
+    return size + 3;
+}
+
+bool state_decode(const void* data, size_t size, char* name, int* capacity)
+{
+    assert(name);
+    assert(capacity);
+    const unsigned char* bytes = (const unsigned char*)data;
+    if (size < 3 || size != (size_t)bytes[0] + 3)
+        return false;
+    size_t name_size = bytes[0];
+    memcpy(name, bytes + 1, name_size);
+    name[name_size] = 0;
+    *capacity = (bytes[1 + name_size] << 8) | bytes[2 + name_size];
+    return true;
+}
+
+void state_reporter_init(state_reporter_t* self, uint64_t min_interval,
+        uint64_t max_delay, uint64_t interval, int threshold)
+{
+    assert(self);
+    assert(min_interval <= max_delay && max_delay <= interval);
+    memset(self, 0, sizeof(state_reporter_t));
+    self->min_interval = min_interval;
+    self->max_delay = max_delay;
+    self->interval = interval;
+    self->threshold = threshold;
+    self->capacity = -1;
+    self->reported = -1;
+}
+
+namespace {
+
+// Time a report of capacity is due at
+uint64_t s_due_at(state_reporter_t* self, int capacity)
+{
+    if (self->reported < 0)
+        return 0;
+    if (capacity == self->reported)
+        return self->reported_at + self->interval;
+    int change = capacity - self->reported;
+    if (change < 0)
+        change = -change;
+    if (capacity == 0 || self->reported == 0 || change >= self->threshold)
+        return self->reported_at + self->min_interval;
+    return self->reported_at + self->max_delay;
+}
+
+}
+
+bool state_reporter_due(state_reporter_t* self, int capacity, uint64_t now)
+{
+    assert(self);
+    if (capacity != self->capacity) {
+        self->capacity = capacity;
+        self->changes++;
+    }
+    if (now < s_due_at(self, capacity))
+        return false;
+    self->reported = capacity;
+    self->reported_at = now;
+    self->reports++;
+    return true;
+}
+
+int state_reporter_wait(state_reporter_t* self, int capacity, uint64_t now)
+{
+    assert(self);
+    uint64_t due_at = s_due_at(self, capacity);
+    return due_at > now ? (int)(due_at - now) : 0;
+}
@@ -0,0 +1,59 @@
+// cluster/state.h
+//
+// State messages a broker broadcasts to its peers, and when to send them.
+// A message is a single frame: the length of the broker's name in one byte,
+// the name, then the spare capacity as 2 bytes in network order.
+// Capacity changes on nearly every task, so the reporter coalesces changes:
+// reports are at least a minimum interval apart, and small changes wait a
+// little longer than going to or from no capacity, or changes of at least a
+// threshold. Unchanged capacity is reported again now and then, so that peers
+// know the last report still holds.
+//
+#ifndef CLUSTER_STATE_H_
+#define CLUSTER_STATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "peers.h"
+
+const size_t STATE_MSG_MAX = 1 + PEER_NAME_MAX + 2;
+
+const uint64_t STATE_MIN_INTERVAL = 50;     // msecs, between reports
+const uint64_t STATE_MAX_DELAY = 250;       // msecs, for small changes
+const uint64_t STATE_INTERVAL = 1000;       // msecs, between unchanged
+                                            // reports, well within
+                                            // PEER_STATE_TTL
+const int STATE_THRESHOLD = 2;              // Capacity change which isn't
+                                            // small
+
+// Encode a state message into buf, of STATE_MSG_MAX bytes, returns its size
+size_t state_encode(void* buf, const char* name, int capacity);
+// Decode a state message, name takes PEER_NAME_MAX + 1 bytes; returns false
+// if the message is malformed
+bool state_decode(const void* data, size_t size, char* name, int* capacity);
+
+struct state_reporter_t {
+    uint64_t min_interval;
+    uint64_t max_delay;
+    uint64_t interval;
+    int threshold;
+    int capacity;           // Capacity last seen
+    int reported;           // Capacity last reported, -1 before first report
+    uint64_t reported_at;   // msecs
+    uint64_t changes;       // Capacity changes seen
+    uint64_t reports;       // Reports sent
+};
+
+void state_reporter_init(state_reporter_t* self,
+        uint64_t min_interval = STATE_MIN_INTERVAL,
+        uint64_t max_delay = STATE_MAX_DELAY,
+        uint64_t interval = STATE_INTERVAL,
+        int threshold = STATE_THRESHOLD);
+// Take the capacity at time now, returns true if it's time to report it; the
+// caller then sends the report
+bool state_reporter_due(state_reporter_t* self, int capacity, uint64_t now);
+// msecs until a report of capacity is due, for poll timeouts
+int state_reporter_wait(state_reporter_t* self, int capacity, uint64_t now);
+
+#endif // CLUSTER_STATE_H_
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 
 #include "endpoint.h"
+#include "peers.h"
 #include "time_util.h"
 
 namespace {
@@ -132,6 +133,11 @@ int main(int argc, char* argv[])
     // Least recently used queue of available workers
     int capacity = 0;
     zlist_t* workers = zlist_new();
+
+    // Peer brokers, to tell replies for them from replies for our clients
+    peers_t* peers = peers_new();
+    for (int i = 2; i < argc; ++i)
+        peers_add(peers, argv[i]);
     
     while (true) {
         // First, route any waiting replies from workers
@@ -172,15 +178,9 @@ int main(int argc, char* argv[])
             zframe_destroy(&identity);
         }
         // Route reply to cloud if it's addressed to a broker
-        for (int i = 2; msg && i < argc; ++i) {
-            char* peer = argv[i];
-            char* data = (char*)zframe_data(zmsg_first(msg));
-            size_t size = zframe_size(zmsg_first(msg));
-            if (size == strlen(peer) && memcmp(data, peer, size) == 0) {
-                zmsg_send(&msg, cloudfe);
-                break;  // Actually no need, cause msg would be set to NULL
-            }
-        }
+        if (msg && peers_lookup(peers, zframe_data(zmsg_first(msg)),
+                    zframe_size(zmsg_first(msg))))
+            zmsg_send(&msg, cloudfe);
         // Route reply to client if still needed
         if (msg) {
             //zframe_print(zmsg_last(msg), "Reply: ");
@@ -241,6 +241,7 @@ int main(int argc, char* argv[])
         zframe_destroy(&frame);
     }
     zlist_destroy(&workers);
+    peers_destroy(&peers);
     zctx_destroy(&ctx);
     return EXIT_SUCCESS;
 }
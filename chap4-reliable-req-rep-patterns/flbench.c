@@ -0,0 +1,259 @@
+/**
+ * @file flbench.c
+ *
+ * @breif Freelance client benchmark
+ * Runs the same closed-loop load twice over TCP, in one process: once
+ * through a load-balancing broker like spqueue to a pool of workers, once
+ * straight to as many freelance servers with the flcli API. Each worker or
+ * server takes the same time per request, so the difference is the broker
+ * hop.
+ *
+ *   flbench [servers] [clients] [seconds] [msecs]
+ */
+#include <czmq.h>
+
+#include "flcliapi.h"
+
+#define WORKER_READY "\001"     // Signals worker is ready
+#define BROKER_FRONTEND "tcp://127.0.0.1:5590"
+#define BROKER_BACKEND "tcp://127.0.0.1:5591"
+#define SERVER_PORT 5570        // Servers on this port and the next ones
+#define MAX_SERVERS 16
+#define MAX_CLIENTS 64
+#define LATENCIES 50000         // Kept per client
+
+typedef struct {
+    int direct;                 // Freelance client, else through the broker
+    int nbr_servers;
+    int seconds;
+    int replies;
+    int failures;               // No reply, or not the one expected
+    int nbr_latencies;
+    int64_t latencies[LATENCIES];  // usecs
+} client_t;
+
+static int s_service_time;      // msecs, per request
+
+// Load-balancing broker, dealing requests to the least recently used worker
+static void* s_broker_task(void* args)
+{
+    zctx_t* ctx = zctx_new();
+    void* frontend = zsocket_new(ctx, ZMQ_ROUTER);
+    void* backend = zsocket_new(ctx, ZMQ_ROUTER);
+    zsocket_bind(frontend, BROKER_FRONTEND);
+    zsocket_bind(backend, BROKER_BACKEND);
+
+    zlist_t* workers = zlist_new();
+    while (true) {
+        zmq_pollitem_t items[] = {
+            { backend, 0, ZMQ_POLLIN, 0 },
+            { frontend, 0, ZMQ_POLLIN, 0 }
+        };
+        int rc = zmq_poll(items, zlist_size(workers) ? 2 : 1, -1);
+        if (rc == -1)
+            break;  // Interrupted
+        if (items[0].revents & ZMQ_POLLIN) {
+            zmsg_t* msg = zmsg_recv(backend);
+            if (!msg)
+                break;  // Interrupted
+            zlist_append(workers, zmsg_unwrap(msg));
+            if (memcmp(zframe_data(zmsg_first(msg)), WORKER_READY, 1) == 0)
+                zmsg_destroy(&msg);
+            else
+                zmsg_send(&msg, frontend);
+        }
+        if (items[1].revents & ZMQ_POLLIN) {
+            zmsg_t* msg = zmsg_recv(frontend);
+            if (!msg)
+                break;  // Interrupted
+            zmsg_wrap(msg, (zframe_t*)zlist_pop(workers));
+            zmsg_send(&msg, backend);
+        }
+    }
+    zlist_destroy(&workers);
+    zctx_destroy(&ctx);
+    return NULL;
+}
+
+static void* s_worker_task(void* args)
+{
+    zctx_t* ctx = zctx_new();
+    void* worker = zsocket_new(ctx, ZMQ_REQ);
+    zsocket_connect(worker, BROKER_BACKEND);
+    zstr_send(worker, WORKER_READY);
+    while (true) {
+        zmsg_t* msg = zmsg_recv(worker);
+        if (!msg)
+            break;  // Interrupted
+        if (s_service_time)
+            zclock_sleep(s_service_time);
+        zmsg_send(&msg, worker);
+    }
+    zctx_destroy(&ctx);
+    return NULL;
+}
+
+// Freelance server, as flserver.c
+static void* s_server_task(void* args)
+{
+    char endpoint[32];
+    sprintf(endpoint, "tcp://127.0.0.1:%d", SERVER_PORT + (int)(size_t)args);
+    zctx_t* ctx = zctx_new();
+    void* server = zsocket_new(ctx, ZMQ_ROUTER);
+    zmq_setsockopt(server, ZMQ_IDENTITY, endpoint, strlen(endpoint));
+    zsocket_bind(server, "%s", endpoint);
+    while (true) {
+        zmsg_t* msg = zmsg_recv(server);
+        if (!msg)
+            break;  // Interrupted
+        zframe_t* identity = zmsg_pop(msg);
+        zframe_t* control = zmsg_pop(msg);
+        if (zframe_streq(control, "PING")) {
+            zframe_reset(control, "PONG", 4);
+            zmsg_destroy(&msg);
+            msg = zmsg_new();
+        } else if (s_service_time) {
+            zclock_sleep(s_service_time);
+        }
+        zmsg_push(msg, control);
+        zmsg_push(msg, identity);
+        zmsg_send(&msg, server);
+    }
+    zctx_destroy(&ctx);
+    return NULL;
+}
+
+static void s_client_task(void* args, zctx_t* ctx, void* pipe)
+{
+    client_t* self = (client_t*)args;
+    flcli_t* flcli = NULL;
+    void* client = NULL;
+    if (self->direct) {
+        flcli = flcli_new();
+        for (int i = 0; i < self->nbr_servers; ++i) {
+            char endpoint[32];
+            sprintf(endpoint, "tcp://127.0.0.1:%d", SERVER_PORT + i);
+            flcli_connect(flcli, endpoint);
+        }
+    } else {
+        client = zsocket_new(ctx, ZMQ_REQ);
+        zsocket_connect(client, BROKER_FRONTEND);
+    }
+
+    uint64_t end = zclock_time() + self->seconds * 1000;
+    int sequence = 0;
+    while (zclock_time() < end) {
+        char request[32];
+        sprintf(request, "%04d-%0x", ++sequence, randof(0x10000));
+        int64_t sent_at = zclock_usecs();
+        char* reply = NULL;
+        if (flcli) {
+            zmsg_t* msg = zmsg_new();
+            zmsg_addstr(msg, request);
+            zmsg_t* reply_msg = flcli_request(flcli, &msg);
+            if (reply_msg) {
+                reply = zmsg_popstr(reply_msg);
+                zmsg_destroy(&reply_msg);
+            }
+        } else {
+            zstr_send(client, request);
+            reply = zstr_recv(client);
+        }
+        int64_t latency = zclock_usecs() - sent_at;
+        // Same check as lpclient, reply must echo the request
+        if (reply && streq(reply, request)) {
+            self->replies++;
+            if (self->nbr_latencies < LATENCIES)
+                self->latencies[self->nbr_latencies++] = latency;
+        } else {
+            self->failures++;
+        }
+        free(reply);
+    }
+    flcli_destroy(&flcli);
+    zstr_send(pipe, "done");
+}
+
+static int s_compare_latency(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Run clients on one path until they're done, and report
+static void s_run(zctx_t* ctx, const char* name, int direct, int nbr_servers,
+        int nbr_clients, int seconds)
+{
+    client_t** clients = (client_t**)zmalloc(nbr_clients * sizeof(client_t*));
+    void** pipes = (void**)zmalloc(nbr_clients * sizeof(void*));
+    for (int i = 0; i < nbr_clients; ++i) {
+        clients[i] = (client_t*)zmalloc(sizeof(client_t));
+        clients[i]->direct = direct;
+        clients[i]->nbr_servers = nbr_servers;
+        clients[i]->seconds = seconds;
+        pipes[i] = zthread_fork(ctx, s_client_task, clients[i]);
+    }
+
+    int replies = 0;
+    int failures = 0;
+    int nbr_latencies = 0;
+    int64_t* latencies =
+        (int64_t*)zmalloc(nbr_clients * LATENCIES * sizeof(int64_t));
+    double total = 0;
+    for (int i = 0; i < nbr_clients; ++i) {
+        free(zstr_recv(pipes[i]));
+        replies += clients[i]->replies;
+        failures += clients[i]->failures;
+        for (int j = 0; j < clients[i]->nbr_latencies; ++j) {
+            latencies[nbr_latencies++] = clients[i]->latencies[j];
+            total += clients[i]->latencies[j];
+        }
+        free(clients[i]);
+    }
+    qsort(latencies, nbr_latencies, sizeof(int64_t), s_compare_latency);
+    if (nbr_latencies) {
+        printf("%-10s %12.1f %10.3f %10.3f %10.3f %10d\n", name,
+                (double)replies / seconds, total / nbr_latencies / 1000,
+                latencies[(nbr_latencies - 1) * 50 / 100] / 1000.0,
+                latencies[(nbr_latencies - 1) * 99 / 100] / 1000.0,
+                failures);
+    } else {
+        printf("%-10s %12s %10s %10s %10s %10d\n", name,
+                "-", "-", "-", "-", failures);
+    }
+    free(latencies);
+    free(pipes);
+    free(clients);
+}
+
+int main(int argc, char* argv[])
+{
+    int nbr_servers = argc > 1 ? atoi(argv[1]) : 4;
+    int nbr_clients = argc > 2 ? atoi(argv[2]) : 4;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    s_service_time = argc > 4 ? atoi(argv[4]) : 0;
+    if (nbr_servers < 1 || nbr_servers > MAX_SERVERS
+            || nbr_clients < 1 || nbr_clients > MAX_CLIENTS
+            || seconds < 1 || s_service_time < 0) {
+        printf("syntax: flbench [servers] [clients] [seconds] [msecs]\n");
+        return 0;
+    }
+
+    zthread_new(s_broker_task, NULL);
+    for (int i = 0; i < nbr_servers; ++i) {
+        zthread_new(s_worker_task, NULL);
+        zthread_new(s_server_task, (void*)(size_t)i);
+    }
+    zclock_sleep(500);  // Let workers and servers come up
+
+    zctx_t* ctx = zctx_new();
+    printf("%-10s %12s %10s %10s %10s %10s\n", "path", "replies/sec",
+            "avg msec", "p50 msec", "p99 msec", "failures");
+    s_run(ctx, "brokered", 0, nbr_servers, nbr_clients, seconds);
+    s_run(ctx, "direct", 1, nbr_servers, nbr_clients, seconds);
+
+    // Broker, workers and servers are blocked on their sockets, don't wait
+    zctx_destroy(&ctx);
+    return 0;
+}
@@ -0,0 +1,252 @@
+// flcliapi.c
+//
+// flcli class - Freelance client API
+// Connects a ROUTER socket to each server and addresses them by endpoint,
+// the servers use it as identity. Servers are pinged to know which ones are
+// alive, and each request goes to the alive server with the lowest smoothed
+// round-trip time. A server which doesn't reply within its timeout is taken
+// as dead until it answers a ping again, and the request goes to the next
+// fastest one.
+//
+// Messages, after the identity frame:
+//   client -> server   "PING"           or  sequence, request...
+//   server -> client   "PONG"           or  sequence, reply...
+//
+#include "flcliapi.h"
+
+#include <czmq.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtt.h"
+
+#define PING_INTERVAL 1000    // msecs, between pings to an alive server
+#define PING_RETRY 100        // msecs, between pings to a dead server
+#define SERVER_TTL 3000       // msecs, dead if not heard of for this long
+#define GLOBAL_TIMEOUT 3000   // msecs, before a request is abandoned
+#define FLCLI_TIMEOUT 1000    // msecs, of a server until its RTT is known
+// msecs, timeout bounds of a server. Timeouts of fast servers stay above a
+// scheduler or GC pause, which would otherwise take a healthy one for dead
+#define FLCLI_TIMEOUT_MIN 50
+#define FLCLI_TIMEOUT_MAX GLOBAL_TIMEOUT
+
+typedef struct {
+    char* endpoint;       // Server identity and endpoint
+    int alive;            // 1 if known to be alive
+    uint64_t ping_at;     // Next ping at this time
+    uint64_t expiry;      // Dead if not heard of by this time
+    rtt_t rtt;            // Round-trip time of requests
+    uint64_t requests;    // Requests sent to server
+    uint64_t failures;    // Requests which timed out
+} server_t;
+
+struct _flcli_t {
+    zctx_t* ctx;
+    void* socket;         // ROUTER socket talking to servers
+    zlist_t* servers;     // Servers we've connected to
+    int sequence;         // Number of last request
+};
+
+static
+void s_server_destroy(server_t** self_p)
+{
+    server_t* self = *self_p;
+    free(self->endpoint);
+    free(self);
+    *self_p = NULL;
+}
+
+flcli_t* flcli_new(void)
+{
+    flcli_t* self = (flcli_t*)zmalloc(sizeof(flcli_t));
+    self->ctx = zctx_new();
+    self->socket = zsocket_new(self->ctx, ZMQ_ROUTER);
+    self->servers = zlist_new();
+    return self;
+}
+
+void flcli_destroy(flcli_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        flcli_t* self = *self_p;
+        while (zlist_size(self->servers)) {
+            server_t* server = (server_t*)zlist_pop(self->servers);
+            s_server_destroy(&server);
+        }
+        zlist_destroy(&self->servers);
+        zctx_destroy(&self->ctx);
+        free(self);
+        *self_p = NULL;
+    }
+}
+
+void flcli_connect(flcli_t* self, const char* endpoint)
+{
+    assert(self);
+    assert(endpoint);
+    server_t* server = (server_t*)zmalloc(sizeof(server_t));
+    server->endpoint = strdup(endpoint);
+    server->ping_at = zclock_time();
+    server->expiry = server->ping_at + SERVER_TTL;
+    rtt_init(&server->rtt, FLCLI_TIMEOUT, FLCLI_TIMEOUT_MIN,
+            FLCLI_TIMEOUT_MAX);
+    zlist_append(self->servers, server);
+    zsocket_connect(self->socket, "%s", endpoint);
+}
+
+// Ping servers which are due, and bury those not heard of for too long.
+// Returns when the next ping is due
+static
+uint64_t s_flcli_ping(flcli_t* self, uint64_t now)
+{
+    uint64_t ping_at = now + PING_INTERVAL;
+    server_t* server = (server_t*)zlist_first(self->servers);
+    while (server) {
+        if (server->alive && now >= server->expiry)
+            server->alive = 0;
+        if (now >= server->ping_at) {
+            // Unroutable while the connection is not up yet, the ROUTER
+            // socket drops it and we ping again soon
+            zstr_sendm(self->socket, server->endpoint);
+            zstr_send(self->socket, "PING");
+            server->ping_at =
+                now + (server->alive ? PING_INTERVAL : PING_RETRY);
+        }
+        if (server->ping_at < ping_at)
+            ping_at = server->ping_at;
+        server = (server_t*)zlist_next(self->servers);
+    }
+    return ping_at;
+}
+
+// Alive server with the lowest smoothed RTT; one never measured yet counts
+// as fastest, so each server gets tried
+static
+server_t* s_flcli_fastest(flcli_t* self)
+{
+    server_t* fastest = NULL;
+    server_t* server = (server_t*)zlist_first(self->servers);
+    while (server) {
+        if (server->alive) {
+            double srtt = server->rtt.nbr_samples ? server->rtt.srtt : 0;
+            if (!fastest || srtt < (fastest->rtt.nbr_samples
+                    ? fastest->rtt.srtt : 0))
+                fastest = server;
+        }
+        server = (server_t*)zlist_next(self->servers);
+    }
+    return fastest;
+}
+
+static
+server_t* s_flcli_lookup(flcli_t* self, zframe_t* identity)
+{
+    server_t* server = (server_t*)zlist_first(self->servers);
+    while (server) {
+        if (zframe_streq(identity, server->endpoint))
+            return server;
+        server = (server_t*)zlist_next(self->servers);
+    }
+    return NULL;
+}
+
+zmsg_t* flcli_request(flcli_t* self, zmsg_t** request_p)
+{
+    assert(self);
+    assert(request_p);
+    zmsg_t* request = *request_p;
+    *request_p = NULL;
+
+    char sequence[12];
+    sprintf(sequence, "%d", ++self->sequence);
+    zmsg_pushstr(request, sequence);
+
+    uint64_t deadline = zclock_time() + GLOBAL_TIMEOUT;
+    server_t* current = NULL;  // Server the request is waiting for
+    int64_t sent_at = 0;
+    int sends = 0;             // Times the request went out, to any server
+    uint64_t expiry = 0;
+    zmsg_t* reply = NULL;
+    while (!reply && !zsys_interrupted) {
+        uint64_t now = zclock_time();
+        if (now >= deadline)
+            break;
+        uint64_t wake_at = s_flcli_ping(self, now);
+        if (!current) {
+            current = s_flcli_fastest(self);
+            if (current) {
+                zmsg_t* msg = zmsg_dup(request);
+                zmsg_pushstr(msg, current->endpoint);
+                zmsg_send(&msg, self->socket);
+                current->requests++;
+                sent_at = zclock_usecs();
+                sends++;
+                expiry = now + rtt_timeout(&current->rtt);
+            }
+        }
+        if (current && expiry < wake_at)
+            wake_at = expiry;
+        if (deadline < wake_at)
+            wake_at = deadline;
+
+        zmq_pollitem_t items[] = {
+            { self->socket, 0, ZMQ_POLLIN, 0 }
+        };
+        int timeout = wake_at > now ? (int)(wake_at - now) : 0;
+        int rc = zmq_poll(items, 1, timeout * ZMQ_POLL_MSEC);
+        if (rc == -1)
+            break;  // Interrupted
+
+        if (items[0].revents & ZMQ_POLLIN) {
+            zmsg_t* msg = zmsg_recv(self->socket);
+            if (!msg)
+                break;  // Interrupted
+            zframe_t* identity = zmsg_pop(msg);
+            server_t* server = s_flcli_lookup(self, identity);
+            zframe_destroy(&identity);
+            char* control = zmsg_popstr(msg);
+            if (server) {
+                // Whatever it sends, the server is alive
+                server->alive = 1;
+                server->expiry = zclock_time() + SERVER_TTL;
+                if (control && streq(control, sequence)) {
+                    // The reply may come from a server we gave up on, and
+                    // once the request was resent, even the current one
+                    // may answer an earlier send; only a request sent once
+                    // tells the RTT for sure (Karn's rule)
+                    if (server == current && sends == 1)
+                        rtt_sample(&server->rtt, zclock_usecs() - sent_at);
+                    reply = msg;
+                    msg = NULL;
+                }
+            }
+            free(control);
+            zmsg_destroy(&msg);  // Pong or late reply
+        }
+        if (!reply && current && zclock_time() >= expiry) {
+            // Bury it until it answers a ping, try the next fastest
+            current->alive = 0;
+            current->failures++;
+            rtt_backoff(&current->rtt);
+            current = NULL;
+        }
+    }
+    zmsg_destroy(&request);
+    return reply;
+}
+
+void flcli_dump(flcli_t* self)
+{
+    assert(self);
+    server_t* server = (server_t*)zlist_first(self->servers);
+    while (server) {
+        printf("I: %s %s, srtt %.2f msec, %" PRIu64 " requests, "
+                "%" PRIu64 " failures\n", server->endpoint,
+                server->alive ? "alive" : "dead", server->rtt.srtt / 1000,
+                server->requests, server->failures);
+        server = (server_t*)zlist_next(self->servers);
+    }
+}
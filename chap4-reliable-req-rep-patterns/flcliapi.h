@@ -0,0 +1,31 @@
+// flcliapi.h
+//
+// Freelance client API
+// Talks to a pool of servers directly, with no broker in between
+//
+#ifndef FLCLIAPI_H_
+#define FLCLIAPI_H_
+
+#include <czmq.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _flcli_t flcli_t;
+
+flcli_t* flcli_new(void);
+void flcli_destroy(flcli_t** self_p);
+// Add a server to the pool; servers use their endpoint as identity
+void flcli_connect(flcli_t* self, const char* endpoint);
+// Send a request to the fastest alive server and return its reply, or NULL
+// if no server replied in time. Takes ownership of the request
+zmsg_t* flcli_request(flcli_t* self, zmsg_t** request_p);
+// Print liveness and round-trip time of each server
+void flcli_dump(flcli_t* self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLCLIAPI_H_
@@ -0,0 +1,57 @@
+// @file flserver.c
+//
+// Freelance server
+// Binds a ROUTER socket with its endpoint as identity, so that clients can
+// address it directly. Answers pings, and echoes requests after simulating
+// some work, like spworker does behind a broker
+//
+#include <czmq.h>
+
+// Serve requests on endpoint, spending msecs on each, until interrupted
+static void s_serve(const char* endpoint, int msecs)
+{
+    zctx_t* ctx = zctx_new();
+    void* server = zsocket_new(ctx, ZMQ_ROUTER);
+    zmq_setsockopt(server, ZMQ_IDENTITY, endpoint, strlen(endpoint));
+    zsocket_bind(server, "%s", endpoint);
+    printf("I: service is ready at %s\n", endpoint);
+
+    while (true) {
+        zmsg_t* msg = zmsg_recv(server);
+        if (!msg)
+            break;  // Interrupted
+        // Frame 0: identity of client
+        // Frame 1: PING, or request sequence
+        // Frame 2+: request body
+        zframe_t* identity = zmsg_pop(msg);
+        zframe_t* control = zmsg_pop(msg);
+        if (!control) {
+            zframe_destroy(&identity);
+            zmsg_destroy(&msg);
+            continue;  // Malformed
+        }
+        if (zframe_streq(control, "PING")) {
+            zframe_reset(control, "PONG", 4);
+            zmsg_destroy(&msg);
+            msg = zmsg_new();
+        } else if (msecs) {
+            zclock_sleep(msecs);
+        }
+        zmsg_push(msg, control);
+        zmsg_push(msg, identity);
+        zmsg_send(&msg, server);
+    }
+    if (zctx_interrupted)
+        printf("W: interrupted\n");
+    zctx_destroy(&ctx);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("syntax: flserver endpoint [msecs]\n");
+        return 0;
+    }
+    s_serve(argv[1], argc > 2 ? atoi(argv[2]) : 0);
+    return 0;
+}
@@ -4,24 +4,67 @@
  * @breif Lazy Pirate Client
  * Use zmq_poll to do a safe request-reply
  * To run, start lpserver and then randomly kill/restart it
+ *
+ *   lpclient                    one request at a time, over REQ
+ *   lpclient pipeline [window]  up to window requests at a time, over DEALER
+ *   lpclient hedge endpoint...  one request at a time, hedged over servers
+ *
+ * In pipeline mode every request carries its sequence number, so replies
+ * may come back in any order, and a request which times out is sent again
+ * on the same socket without disturbing the others in flight.
+ *
+ * In hedge mode each request goes to the next server in turn; if that one
+ * hasn't replied once it's slower than it is 95% of the time, the request
+ * also goes to the server after it, and the first valid reply wins. Late
+ * replies to a request already answered are dropped.
+ *
+ * The timeout follows the server's round-trip time, see rtt.h; it starts at
+ * REQUEST_TIMEOUT and doubles on each timeout until a reply comes back.
  */
 #include <czmq.h>
 
+#include "rtt.h"
+
 namespace {
 
-const int REQUEST_TIMEOUT = 2500;  // msec, (> 1000!)
+const int REQUEST_TIMEOUT = 2500;  // msec, until the RTT is known
+// msec, timeout bounds. Timeouts of a fast server stay above a scheduler or
+// GC pause, which would otherwise take a healthy one for dead
+const int REQUEST_TIMEOUT_MIN = 50;
+const int REQUEST_TIMEOUT_MAX = 60000;
 const int REQUEST_RETRIES = 3;     // before abandon
 const char SERVER_ENDPOINT[] = "tcp://127.0.0.1:5555";
+const int WINDOW_DEFAULT = 8;      // Requests in flight, in pipeline mode
+const int WINDOW_MAX = 1024;
+const int HEDGE_PERCENTILE = 95;   // Hedge once the RTT passes this
+const int SERVERS_MAX = 16;        // Servers, in hedge mode
+const int LATENCIES = 1024;        // Latencies kept for each report
 
-}
+// A request in flight, in pipeline mode
+struct pending_t {
+    int seq;              // Sequence number, 0 when slot is free
+    char request[32];     // Request as sent, to validate the reply
+    int64_t sent_at;      // Sent at this time, usecs
+    uint64_t expiry;      // Send again at this time
+    int retries_left;     // Before abandon
+};
 
-int main()
+// A server, in hedge mode
+struct server_t {
+    void* socket;         // DEALER, to talk to this server alone
+    rtt_t rtt;            // Round-trip time of this server
+    int seq;              // Last request sent to server, 0 once answered
+    int sends;            // Times it was sent
+    int64_t sent_at;      // Last sent at this time, usecs
+};
+
+void lazy_pirate(zctx_t* ctx)
 {
-    zctx_t* ctx = zctx_new();
     printf("I: connecting to server '%s'...\n", SERVER_ENDPOINT);
     void* client = zsocket_new(ctx, ZMQ_REQ);
     zsocket_connect(client, SERVER_ENDPOINT);
-    srandom((unsigned int)time(0));
+    rtt_t rtt;
+    rtt_init(&rtt, REQUEST_TIMEOUT, REQUEST_TIMEOUT_MIN, REQUEST_TIMEOUT_MAX);
 
     int interrupted = 0;
     int retries_left = REQUEST_RETRIES;
@@ -30,6 +73,7 @@ int main()
     while (retries_left && !interrupted) {
         sprintf(request, "%04d-%0x", ++request_seq, randof(0x10000));
         zstr_send(client, request);
+        int64_t sent_at = zclock_usecs();
 
         int expect_reply = 1;
         while (expect_reply && !interrupted) {
@@ -37,7 +81,8 @@ int main()
             zmq_pollitem_t items[] = {
                 { client, 0, ZMQ_POLLIN, 0 }
             };
-            int rc = zmq_poll(items, 1, REQUEST_TIMEOUT * ZMQ_POLL_MSEC);
+            int timeout = rtt_timeout(&rtt);
+            int rc = zmq_poll(items, 1, timeout * ZMQ_POLL_MSEC);
             if (rc == -1) {
                 interrupted = 1;
                 break;  // Interrupted
@@ -50,6 +95,8 @@ int main()
                 }
                 if (strcmp(reply, request) == 0) {
                     printf("I: server replied ok (%s)\n", reply);
+                    // A new socket only gets the reply to the last send
+                    rtt_sample(&rtt, zclock_usecs() - sent_at);
                     retries_left = REQUEST_RETRIES;
                     expect_reply = 0;
                 } else if (retries_left--) {
@@ -60,7 +107,9 @@ int main()
                 printf("E: server seems to be offline, abandoning\n");
                 break;
             } else {
-                printf("W: no response from server, retrying...\n");
+                printf("W: no response from server within %dms, "
+                        "retrying...\n", timeout);
+                rtt_backoff(&rtt);
                 // Old socket is confused, close it and open an new one
                 zsocket_destroy(ctx, client);
                 printf("I: reconnecting to server...\n");
@@ -68,10 +117,315 @@ int main()
                 zsocket_connect(client, SERVER_ENDPOINT);
                 // Resend the request
                 zstr_send(client, request);
+                sent_at = zclock_usecs();
+            }
+        }
+    }
+}
+
+// Send a request from a DEALER socket to the REP server, which expects an
+// empty delimiter frame in front of it
+void pipeline_send(void* client, pending_t* pending, const rtt_t* rtt)
+{
+    zstr_sendm(client, "");
+    zstr_send(client, pending->request);
+    pending->sent_at = zclock_usecs();
+    pending->expiry = zclock_time() + rtt_timeout(rtt);
+}
+
+void pipeline(zctx_t* ctx, int window)
+{
+    printf("I: connecting to server '%s', %d requests in flight...\n",
+            SERVER_ENDPOINT, window);
+    void* client = zsocket_new(ctx, ZMQ_DEALER);
+    zsocket_connect(client, SERVER_ENDPOINT);
+    rtt_t rtt;
+    rtt_init(&rtt, REQUEST_TIMEOUT, REQUEST_TIMEOUT_MIN, REQUEST_TIMEOUT_MAX);
+
+    // Request seq lives in slot seq % window, so the window also bounds how
+    // far newer requests can get ahead of the oldest one still unanswered
+    pending_t* slots = (pending_t*)zmalloc(window * sizeof(pending_t));
+    int next_seq = 1;
+    int in_flight = 0;
+    int replies = 0;
+    int retransmits = 0;
+    uint64_t report_at = zclock_time() + 1000;
+
+    while (true) {
+        // Fill the window
+        while (slots[next_seq % window].seq == 0) {
+            pending_t* pending = &slots[next_seq % window];
+            pending->seq = next_seq++;
+            pending->retries_left = REQUEST_RETRIES;
+            sprintf(pending->request, "%04d-%0x", pending->seq,
+                    randof(0x10000));
+            pipeline_send(client, pending, &rtt);
+            in_flight++;
+        }
+
+        // Wait for a reply until the oldest request times out
+        uint64_t now = zclock_time();
+        uint64_t expiry = report_at;
+        for (int i = 0; i < window; ++i) {
+            if (slots[i].seq && slots[i].expiry < expiry)
+                expiry = slots[i].expiry;
+        }
+        zmq_pollitem_t items[] = {
+            { client, 0, ZMQ_POLLIN, 0 }
+        };
+        int timeout = expiry > now ? (int)(expiry - now) : 0;
+        int rc = zmq_poll(items, 1, timeout * ZMQ_POLL_MSEC);
+        if (rc == -1)
+            break;  // Interrupted
+
+        if (items[0].revents & ZMQ_POLLIN) {
+            zmsg_t* msg = zmsg_recv(client);
+            if (!msg)
+                break;  // Interrupted
+            // Drop the empty delimiter, check reply against its request
+            zframe_t* delimiter = zmsg_pop(msg);
+            zframe_destroy(&delimiter);
+            char* reply = zmsg_popstr(msg);
+            zmsg_destroy(&msg);
+            int seq = reply ? atoi(reply) : 0;
+            pending_t* pending = seq > 0 ? &slots[seq % window] : NULL;
+            if (!pending || pending->seq != seq) {
+                // Answer to a request sent twice, already answered
+                printf("W: duplicate reply from server: %s\n",
+                        reply ? reply : "");
+            } else if (strcmp(reply, pending->request) == 0) {
+                printf("I: server replied ok (%s)\n", reply);
+                // Only a request sent once tells the RTT for sure
+                if (pending->retries_left == REQUEST_RETRIES)
+                    rtt_sample(&rtt, zclock_usecs() - pending->sent_at);
+                pending->seq = 0;
+                in_flight--;
+                replies++;
+            } else {
+                printf("E: malformed reply from server: %s\n", reply);
+            }
+            free(reply);
+        }
+
+        // Send again only the requests which timed out
+        now = zclock_time();
+        bool abandon = false;
+        bool timed_out = false;
+        for (int i = 0; i < window && !abandon; ++i) {
+            pending_t* pending = &slots[i];
+            if (pending->seq == 0 || pending->expiry > now)
+                continue;
+            if (!timed_out) {
+                // Once for all the requests which timed out together
+                rtt_backoff(&rtt);
+                timed_out = true;
+            }
+            if (--pending->retries_left == 0) {
+                printf("E: server seems to be offline, abandoning\n");
+                abandon = true;
+            } else {
+                printf("W: no response to %s, retrying...\n",
+                        pending->request);
+                pipeline_send(client, pending, &rtt);
+                retransmits++;
+            }
+        }
+        if (abandon)
+            break;
+
+        if (now >= report_at) {
+            printf("I: %d replies/sec, %d in flight, %d retransmitted, "
+                    "timeout %dms\n", replies, in_flight, retransmits,
+                    rtt_timeout(&rtt));
+            replies = 0;
+            retransmits = 0;
+            report_at = now + 1000;
+        }
+    }
+    free(slots);
+}
+
+// Send a request to one server, from its own DEALER socket
+void hedge_send(server_t* server, int seq, const char* request)
+{
+    zstr_sendm(server->socket, "");
+    zstr_send(server->socket, request);
+    server->sends = server->seq == seq ? server->sends + 1 : 1;
+    server->seq = seq;
+    server->sent_at = zclock_usecs();
+}
+
+int compare_latency(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+void hedge(zctx_t* ctx, char** endpoints, int nbr_servers)
+{
+    server_t* servers = (server_t*)zmalloc(nbr_servers * sizeof(server_t));
+    zmq_pollitem_t* items =
+        (zmq_pollitem_t*)zmalloc(nbr_servers * sizeof(zmq_pollitem_t));
+    for (int i = 0; i < nbr_servers; ++i) {
+        printf("I: connecting to server '%s'...\n", endpoints[i]);
+        servers[i].socket = zsocket_new(ctx, ZMQ_DEALER);
+        zsocket_connect(servers[i].socket, endpoints[i]);
+        rtt_init(&servers[i].rtt, REQUEST_TIMEOUT, REQUEST_TIMEOUT_MIN,
+                REQUEST_TIMEOUT_MAX);
+        items[i].socket = servers[i].socket;
+        items[i].events = ZMQ_POLLIN;
+    }
+
+    int64_t latencies[LATENCIES];
+    int nbr_latencies = 0;
+    int hedges = 0;      // Requests sent to a second server
+    int hedge_wins = 0;  // Requests answered by the second server first
+    int duplicates = 0;  // Late replies dropped
+    uint64_t report_at = zclock_time() + 1000;
+
+    bool interrupted = false;
+    int retries_left = REQUEST_RETRIES;
+    int request_seq = 0;
+    char request[32] = { 0 };
+    while (retries_left && !interrupted) {
+        sprintf(request, "%04d-%0x", ++request_seq, randof(0x10000));
+        int primary = request_seq % nbr_servers;
+        server_t* first = &servers[primary];
+        server_t* second = &servers[(primary + 1) % nbr_servers];
+        int64_t started_at = zclock_usecs();
+        hedge_send(first, request_seq, request);
+        uint64_t now = zclock_time();
+        int wait = rtt_timeout(&first->rtt);
+        uint64_t expiry = now + wait;
+        uint64_t hedge_at =
+            now + (uint64_t)(rtt_percentile(&first->rtt, HEDGE_PERCENTILE)
+                / 1000);
+        bool hedged = nbr_servers < 2;  // Nobody to hedge with
+
+        int answered_by = -1;
+        while (answered_by < 0 && retries_left && !interrupted) {
+            now = zclock_time();
+            uint64_t wake_at = !hedged && hedge_at < expiry ? hedge_at : expiry;
+            int timeout = wake_at > now ? (int)(wake_at - now) : 0;
+            int rc = zmq_poll(items, nbr_servers, timeout * ZMQ_POLL_MSEC);
+            if (rc == -1) {
+                interrupted = true;
+                break;  // Interrupted
+            }
+            for (int i = 0; i < nbr_servers; ++i) {
+                if (!(items[i].revents & ZMQ_POLLIN))
+                    continue;
+                zmsg_t* msg = zmsg_recv(servers[i].socket);
+                if (!msg) {
+                    interrupted = true;
+                    break;  // Interrupted
+                }
+                zframe_t* delimiter = zmsg_pop(msg);
+                zframe_destroy(&delimiter);
+                char* reply = zmsg_popstr(msg);
+                zmsg_destroy(&msg);
+                int seq = reply ? atoi(reply) : 0;
+
+                // Every reply tells the RTT of the server which sent it,
+                // even one which lost the race
+                server_t* server = &servers[i];
+                if (seq > 0 && seq == server->seq) {
+                    if (server->sends == 1)
+                        rtt_sample(&server->rtt,
+                                zclock_usecs() - server->sent_at);
+                    server->seq = 0;
+                }
+                if (seq != request_seq || answered_by >= 0) {
+                    duplicates++;
+                } else if (strcmp(reply, request) == 0) {
+                    answered_by = i;
+                } else {
+                    printf("E: malformed reply from server: %s\n", reply);
+                }
+                free(reply);
+            }
+            if (answered_by >= 0 || interrupted)
+                break;
+
+            now = zclock_time();
+            if (!hedged && now >= hedge_at) {
+                hedge_send(second, request_seq, request);
+                hedged = true;
+                hedges++;
             }
+            if (now >= expiry) {
+                if (--retries_left == 0) {
+                    printf("E: servers seem to be offline, abandoning\n");
+                } else {
+                    printf("W: no response within %dms, retrying...\n", wait);
+                    rtt_backoff(&first->rtt);
+                    hedge_send(first, request_seq, request);
+                    wait = rtt_timeout(&first->rtt);
+                    expiry = now + wait;
+                    hedge_at = now + (uint64_t)(rtt_percentile(&first->rtt,
+                        HEDGE_PERCENTILE) / 1000);
+                    hedged = nbr_servers < 2;
+                }
+            }
+        }
+        if (answered_by < 0)
+            continue;
+
+        printf("I: server %d replied ok (%s)\n", answered_by, request);
+        retries_left = REQUEST_RETRIES;
+        if (answered_by != primary)
+            hedge_wins++;
+        if (nbr_latencies < LATENCIES)
+            latencies[nbr_latencies++] = zclock_usecs() - started_at;
+
+        now = zclock_time();
+        if (now >= report_at) {
+            qsort(latencies, nbr_latencies, sizeof(int64_t), compare_latency);
+            printf("I: %d replies, latency p50 %.2f p95 %.2f p99 %.2f msec, "
+                    "%d hedged, %d won by hedge, %d duplicates\n",
+                    nbr_latencies,
+                    latencies[(nbr_latencies - 1) * 50 / 100] / 1000.0,
+                    latencies[(nbr_latencies - 1) * 95 / 100] / 1000.0,
+                    latencies[(nbr_latencies - 1) * 99 / 100] / 1000.0,
+                    hedges, hedge_wins, duplicates);
+            nbr_latencies = 0;
+            hedges = hedge_wins = duplicates = 0;
+            report_at = now + 1000;
+        }
+    }
+    free(items);
+    free(servers);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int window = 0;
+    int nbr_servers = 0;
+    if (argc > 1 && streq(argv[1], "hedge")) {
+        nbr_servers = argc - 2;
+        if (nbr_servers < 1 || nbr_servers > SERVERS_MAX) {
+            printf("syntax: lpclient hedge endpoint...\n");
+            return 0;
+        }
+    } else if (argc > 1) {
+        window = argc > 2 ? atoi(argv[2]) : WINDOW_DEFAULT;
+        if (!streq(argv[1], "pipeline") || window < 1 || window > WINDOW_MAX) {
+            printf("syntax: lpclient [pipeline [window] | hedge endpoint...]\n");
+            return 0;
         }
     }
 
+    zctx_t* ctx = zctx_new();
+    srandom((unsigned int)time(0));
+    if (nbr_servers)
+        hedge(ctx, argv + 2, nbr_servers);
+    else if (window)
+        pipeline(ctx, window);
+    else
+        lazy_pirate(ctx);
     zctx_destroy(&ctx);
     return 0;
 }
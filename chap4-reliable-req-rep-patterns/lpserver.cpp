@@ -5,6 +5,17 @@
  * Binds REP socket, resembles hwserver except:
  *  - echo request as-is
  *  - randomly run slowly, or exit to simulate a crash
+ *
+ *   lpserver                                   one request at a time
+ *   lpserver threads [workers] [msecs] [faults] [endpoint]
+ *
+ * In threads mode a ROUTER socket takes requests from clients and hands
+ * each one to the least recently used of a pool of worker threads over
+ * inproc, so requests are served concurrently. Each worker takes msecs per
+ * request. After a few requests, one request in faults makes the server
+ * crash, and one in faults makes a worker run slowly; faults 0 turns both
+ * off. Several servers can run side by side on different endpoints, for
+ * clients which spread requests over servers.
  */
 #include <czmq.h>
 #include <assert.h>
@@ -14,15 +25,132 @@
 namespace {
 
 const char SERVER_ENDPOINT[] = "tcp://*:5555";
+const char WORKERS_ENDPOINT[] = "inproc://workers";
+const char WORKER_READY[] = "\001";  // Signals worker is ready
+
+const int WORKERS_DEFAULT = 8;
+const int SERVICE_TIME_DEFAULT = 1000;  // msecs
+const int FAULTS_DEFAULT = 3;           // One request in this many
+const int WARMUP_CYCLES = 3;            // Requests before any fault
+
+struct options_t {
+    int service_time;
+    int faults;
+};
 
+void worker_task(void* args, zctx_t* ctx, void* pipe)
+{
+    options_t* options = (options_t*)args;
+    void* worker = zsocket_new(ctx, ZMQ_REQ);
+    zsocket_connect(worker, WORKERS_ENDPOINT);
+
+    zframe_t* frame = zframe_new(WORKER_READY, 1);
+    zframe_send(&frame, worker, 0);
+    while (true) {
+        // Request comes with the client's envelope, which goes back as is
+        zmsg_t* msg = zmsg_recv(worker);
+        if (!msg)
+            break;  // Interrupted
+        if (options->faults && randof(options->faults) == 0) {
+            printf("I: (%x) simulating CPU overload\n", zthread_id());
+            zclock_sleep(2000);
+        }
+        zclock_sleep(options->service_time);
+        zmsg_send(&msg, worker);
+    }
 }
 
-int main()
+// Serve requests with a pool of worker threads
+void serve_threads(zctx_t* ctx, void* server, int nbr_workers,
+        options_t* options)
 {
+    void* backend = zsocket_new(ctx, ZMQ_ROUTER);
+    zsocket_bind(backend, WORKERS_ENDPOINT);
+    for (int i = 0; i < nbr_workers; ++i)
+        zthread_fork(ctx, worker_task, options);
+
+    // Identities of workers ready for a request, oldest first
+    zlist_t* workers = zlist_new();
+    int cycles = 0;
+    while (true) {
+        zmq_pollitem_t items[] = {
+            { backend, 0, ZMQ_POLLIN, 0 },
+            { server, 0, ZMQ_POLLIN, 0 }
+        };
+        // Take requests from clients only while a worker is ready
+        int rc = zmq_poll(items, zlist_size(workers) ? 2 : 1, -1);
+        if (rc == -1)
+            break;  // Interrupted
+
+        if (items[0].revents & ZMQ_POLLIN) {
+            zmsg_t* msg = zmsg_recv(backend);
+            if (!msg)
+                break;  // Interrupted
+            zlist_append(workers, zmsg_unwrap(msg));
+            zframe_t* frame = zmsg_first(msg);
+            if (memcmp(zframe_data(frame), WORKER_READY, 1) == 0)
+                zmsg_destroy(&msg);
+            else
+                zmsg_send(&msg, server);
+        }
+        if (items[1].revents & ZMQ_POLLIN) {
+            zmsg_t* msg = zmsg_recv(server);
+            if (!msg)
+                break;  // Interrupted
+            // Simulate a crash, after a few cycles
+            cycles++;
+            if (cycles > WARMUP_CYCLES && options->faults
+                    && randof(options->faults) == 0) {
+                printf("I: simulating a crash\n");
+                zmsg_destroy(&msg);
+                break;
+            }
+            zmsg_wrap(msg, (zframe_t*)zlist_pop(workers));
+            zmsg_send(&msg, backend);
+        }
+    }
+
+    while (zlist_size(workers)) {
+        zframe_t* frame = (zframe_t*)zlist_pop(workers);
+        zframe_destroy(&frame);
+    }
+    zlist_destroy(&workers);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int nbr_workers = 0;
+    const char* endpoint = SERVER_ENDPOINT;
+    options_t options = { SERVICE_TIME_DEFAULT, FAULTS_DEFAULT };
+    if (argc > 1) {
+        nbr_workers = argc > 2 ? atoi(argv[2]) : WORKERS_DEFAULT;
+        if (argc > 3)
+            options.service_time = atoi(argv[3]);
+        if (argc > 4)
+            options.faults = atoi(argv[4]);
+        if (argc > 5)
+            endpoint = argv[5];
+        if (!streq(argv[1], "threads") || nbr_workers < 1
+                || options.service_time < 0 || options.faults < 0) {
+            printf("syntax: lpserver "
+                    "[threads [workers] [msecs] [faults] [endpoint]]\n");
+            return 0;
+        }
+    }
+
     zctx_t* ctx = zctx_new();
-    void* server = zsocket_new(ctx, ZMQ_REP);
-    zsocket_bind(server, SERVER_ENDPOINT);
+    void* server = zsocket_new(ctx, nbr_workers ? ZMQ_ROUTER : ZMQ_REP);
+    zsocket_bind(server, endpoint);
     srandom((unsigned int)time(0));
+    if (nbr_workers) {
+        printf("I: serving with %d worker threads, %d msecs per request\n",
+                nbr_workers, options.service_time);
+        serve_threads(ctx, server, nbr_workers, &options);
+        zctx_destroy(&ctx);
+        return 0;
+    }
 
     int cycles = 0;
     while (1) {
@@ -8,12 +8,16 @@
  */
 #include <czmq.h>
 #include "mdp.h"
+#include "slab.h"
 
 // @note These would normally be pulled from config
 const int HEARTBEAT_LIVENESS 3;     // 3-5 would be reasonable
 const int HEARTBEAT_INTERVAL 2500;  // msec.
 // reconnect after these msec.
 const int HEARTBEAT_EXPIRY HEARTBEAT_INTERVAL * HEARTBEAT_LIVENESS;
+// Service names are kept inline, longer names are rejected: clients get a
+// "400" reply and workers are disconnected, see s_service_require
+#define SERVICE_NAME_MAX 255
 
 // Broker
 typedef struct {
@@ -25,6 +29,7 @@ typedef struct {
     zhash_t* workers;
     zlist_t* waitings;
     uint64_t heartbeat_at;
+    slab_t* service_pool;  // Pool of service objects
 } broker_t;
 
 static broker_t* s_broker_new(int verbose);
@@ -37,7 +42,7 @@ static void s_broker_purge(broker_t* self);
 // Service
 typedef struct {
     broker_t* broker;   // Broker instance
-    char* name;         // Service name
+    char name[SERVICE_NAME_MAX + 1];  // Service name
     zlist_t* requests;  // List of client requests
     zlist_t* waiting;   // List of waiting workers
     size_t worker_num;  // Number of workers
@@ -78,6 +83,7 @@ broker_t* s_broker_new(int verbose)
     self->workers = zhash_new();
     self->waiting = zlist_new();
     self->heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
+    self->service_pool = slab_new(sizeof(service_t), 64);
 
     return self;
 }
@@ -95,6 +101,7 @@ static void s_broker_destroy(broker_t** self_p)
         zhash_destroy(&self->services);
         zhash_destroy(&self->workers);
         zlist_destroy(&self->waiting);
+        slab_destroy(&self->service_pool);
         free(self);
         *self_p = NULL;
     }
@@ -136,8 +143,13 @@ static void s_broker_worker_msg(broker_t* self, zframe_t* sender, zmsg_t* msg)
             // Attach worker to service and mark as idle
             zframe_t* service_frame = zmsg_pop(msg);
             worker->service = s_service_require(self, service_frame);
-            worker->service->worker_num++;
-            s_worker_waiting(worker);
+            if (worker->service) {
+                worker->service->worker_num++;
+                s_worker_waiting(worker);
+            } else {
+                zclock_log("E: service name too long from worker");
+                s_worker_delete(worker, 1);
+            }
             zframe_destroy(&service_frame);
         }
     } else if (zframe_streq(command, MDPW_REPLY)) {
@@ -178,6 +190,17 @@ static void s_broker_client_msg(broker_t* self, zframe_t* sender, zmsg_t* msg)
 
     zframe_t* service_frame = zmsg_pop(msg);
     service_t* service = s_service_require(self, service_frame);
+    if (!service) {
+        // Reply to a service name too long with an error code, as MMI does
+        zmsg_t* reply = zmsg_new();
+        zmsg_addstr(reply, "400");
+        zmsg_push(reply, service_frame);
+        zmsg_pushstr(reply, MDPC_HEADER);
+        zmsg_wrap(reply, zframe_dup(sender));
+        zmsg_send(&reply, self->socket);
+        zmsg_destroy(&msg);
+        return;
+    }
     // Set reply return identity to sender
     zmsg_wrap(msg, zframe_dup(sender));
     // If we got a MMI service request, process that internally
@@ -227,17 +250,26 @@ static void s_broker_purge(broker_t* self)
 }
 
 // Lazy constructor that locates a service by name or creates a new one if not
-// exists yet.
+// exists yet. This runs for every client request, so the name is looked up
+// from a stack buffer and new services come from the pool. Returns NULL for
+// names longer than SERVICE_NAME_MAX, which would otherwise be cut short and
+// could name the same service as another.
 static service_t* s_service_require(broker_t* self, zframe_t* service_frame)
 {
     assert(service_frame);
 
-    char* service_name = zframe_strdup(service_frame);
+    char service_name[SERVICE_NAME_MAX + 1];
+    size_t name_size = zframe_size(service_frame);
+    if (name_size > SERVICE_NAME_MAX)
+        return NULL;
+    memcpy(service_name, zframe_data(service_frame), name_size);
+    service_name[name_size] = 0;
+
     service_t* service = (service_t*)zhash_lookup(self->services, service_name);
     if (!service) {
-        service = (service_t*)zmalloc(sizeof(service_t));
+        service = (service_t*)slab_alloc(self->service_pool);
         service->broker = self;
-        service->name = strdup(service_name);
+        strcpy(service->name, service_name);
         service->requests = zlist_new();
         service->waiting = zlist_new();
         service->worker_num = 0;
@@ -246,7 +278,6 @@ static service_t* s_service_require(broker_t* self, zframe_t* service_frame)
         if (self->verbose)
             zclock_log("I: added service: %s", service_name);
     }
-    free(service_name);
 
     return service;
 }
@@ -260,8 +291,7 @@ static void s_service_destroy(void* argument)
     }
     zlist_destroy(&service->requests);
     zlist_destroy(&service->waiting);
-    free(service->name);
-    free(service);
+    slab_free(service->broker->service_pool, service);
 }
 
 // Dispatch requests to waiting workers
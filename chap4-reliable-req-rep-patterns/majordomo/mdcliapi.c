@@ -2,6 +2,8 @@
 //
 // mdcliapi class - Majordomo Protocol Client API
 // Implements the MDP/Client spec at http://rfc.zeromq.org/spec:7.
+// The timeout of each request follows the round-trip time of its service,
+// see rtt.h, services can be as fast as a cache or as slow as a batch job.
 //
 #include "mdcliapi.h"
 
@@ -10,15 +12,22 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "rtt.h"
+
 #define MDPC_CLIENT "MDPC01"
+// msecs, timeout bounds. Timeouts of fast services stay above a scheduler or
+// GC pause, which would otherwise take a healthy one for dead
+#define MDCLI_TIMEOUT_MIN 50
+#define MDCLI_TIMEOUT_MAX 60000
 
 struct _mdcli_t {
     zctx_t* ctx;
     char* broker;
     void* client;
     int verbose;
-    int timeout;
+    int timeout;      // Until the RTT of a service is known
     int retries;
+    zhash_t* rtts;    // RTT estimator of each service
 };
 
 static
@@ -42,6 +51,7 @@ mdcli_t* mdcli_new(const char* broker, int verbose)
     self->verbose = verbose;
     self->timeout = 2500;
     self->retries = 3;
+    self->rtts = zhash_new();
 
     s_mdcli_connect_to_broker(self);
     return self;
@@ -53,6 +63,7 @@ void mdcli_destroy(mdcli_t** self_p)
     if (*self_p) {
         mdcli_t* self = *self_p;
         zctx_destroy(&self->ctx);
+        zhash_destroy(&self->rtts);
         free(self->broker);
         free(self);
         *self_p = NULL;
@@ -71,6 +82,39 @@ void mdcli_set_retries(mdcli_t* self, int retries)
     self->retries = retries;
 }
 
+// Estimator of the service, created on first use
+static rtt_t* s_mdcli_rtt_require(mdcli_t* self, const char* service)
+{
+    rtt_t* rtt = (rtt_t*)zhash_lookup(self->rtts, service);
+    if (!rtt) {
+        int initial = self->timeout;
+        if (initial < MDCLI_TIMEOUT_MIN)
+            initial = MDCLI_TIMEOUT_MIN;
+        if (initial > MDCLI_TIMEOUT_MAX)
+            initial = MDCLI_TIMEOUT_MAX;
+        rtt = (rtt_t*)zmalloc(sizeof(rtt_t));
+        rtt_init(rtt, initial, MDCLI_TIMEOUT_MIN, MDCLI_TIMEOUT_MAX);
+        zhash_insert(self->rtts, service, rtt);
+        zhash_freefn(self->rtts, service, free);
+    }
+    return rtt;
+}
+
+// Check the protocol frames of a reply from service, and strip them; 0 if
+// the reply is malformed or from another service
+static int s_mdcli_reply_strip(zmsg_t* reply, const char* service)
+{
+    if (zmsg_size(reply) < 3)
+        return 0;
+    zframe_t* header = zmsg_pop(reply);
+    zframe_t* reply_service = zmsg_pop(reply);
+    int valid = zframe_streq(header, MDPC_CLIENT)
+        && zframe_streq(reply_service, service);
+    zframe_destroy(&header);
+    zframe_destroy(&reply_service);
+    return valid;
+}
+
 zmsg_t* mdcli_send(mdcli_t* self, const char* service, zmsg_t** request_p)
 {
     assert(self);
@@ -87,40 +131,51 @@ zmsg_t* mdcli_send(mdcli_t* self, const char* service, zmsg_t** request_p)
         zmsg_dump(request);
     }
 
+    rtt_t* rtt = s_mdcli_rtt_require(self, service);
     int retries_left = self->retries;
     // Poll for reply
     while (retries_left && !zsys_interrupted) {
         zmsg_t* msg = zmsg_dup(request);
         zmsg_send(&msg, self->client);
+        int64_t sent_at = zclock_usecs();
 
         zmq_pollitem_t items[] = {
             { self->client, 0, ZMQ_POLLIN, 0 }
         };
-        int rc = zmq_poll(items, 1, self->timeout * ZMQ_POLL_MSEC);
+        int timeout = rtt_timeout(rtt);
+        int rc = zmq_poll(items, 1, timeout * ZMQ_POLL_MSEC);
         if (rc == -1)
             break;  // Interrupted
 
+        int timed_out = 1;
         if (items[0].revents & ZMQ_POLLIN) {
             zmsg_t* reply = zmsg_recv(self->client);
+            if (!reply)
+                break;  // Interrupted
+            int64_t elapsed = zclock_usecs() - sent_at;
             if (self->verbose) {
                 zclock_log("I: received reply:");
                 zmsg_dump(reply);
             }
-            // Protocol check
-            assert(zmsg_size(reply) >= 3);
-            zframe_t* header = zmsg_pop(reply);
-            assert(zframe_streq(header, MDPC_CLIENT));
-            zframe_destroy(&header);
-
-            zframe_t* reply_service = zmsg_pop(reply);
-            assert(zframe_streq(reply_service, service));
-            zframe_destroy(&reply_service);
-
-            zmsg_destroy(&request);
-            return reply;
-        } else if (--retries_left) {
-            if (self->verbose)
-                zclock_log("W: no reply within %dms, reconnecting...", self->timeout);
+            // Protocol check, only then the reply answers our request, and
+            // the socket is new after each timeout, so it answers the last
+            // send and tells the round-trip time of the service
+            if (s_mdcli_reply_strip(reply, service)) {
+                rtt_sample(rtt, elapsed);
+                zmsg_destroy(&request);
+                return reply;
+            }
+            zclock_log("E: invalid reply from broker, discarding");
+            zmsg_destroy(&reply);
+            timed_out = 0;
+        }
+        if (--retries_left) {
+            if (timed_out) {
+                if (self->verbose)
+                    zclock_log("W: no reply within %dms, reconnecting...",
+                            timeout);
+                rtt_backoff(rtt);
+            }
             s_mdcli_connect_to_broker(self);
         } else {
             if (self->verbose)
@@ -9,6 +9,10 @@ typedef struct _mdcli_t mdcli_t;
 
 mdcli_t* mdcli_new(const char* broker, int verbose);
 void mdcli_destroy(mdcli_t** self_p);
+// Timeout of a request to a service until its round-trip time is known,
+// msecs; after that the timeout follows the round-trip time
+void mdcli_set_timeout(mdcli_t* self, int timeout);
+void mdcli_set_retries(mdcli_t* self, int retries);
 zmsg_t* mdcli_send(mdcli_t* session, const char* service, zmsg_t** request_p);
 
 #endif // MDCLIAPI_H_
@@ -24,7 +24,9 @@ struct _mdwrk_t {
     uint64_t heartbeat_at;  // when to send heartbeat
     size_t liveness;        // how many attempt left
     int heartbeat_intv;
-    int reconnect_delay;
+    int reconnect_delay;    // next delay, grows while the broker is away
+    int reconnect_base;     // least delay, as configured
+    uint64_t jitter_seed;   // private random state for reconnect jitter
 
     int expect_reply;
     zframe_t* reply_to;
@@ -49,6 +51,28 @@ void s_mdwrk_send_to_broker(mdwrk_t* self, char* command, char* option,
         zmsg_dump(msg);
     }
     zmsg_send(&msg, self->worker);
+    // Any traffic to the broker proves we're alive, so there's no need to
+    // heartbeat until a whole interval passes without sending anything
+    self->heartbeat_at = zclock_time() + self->heartbeat_intv;
+}
+
+// decorrelated jitter backoff: the next delay is picked at random between the
+// configured delay and three times the last one, so workers which lost the
+// broker together don't reconnect in lockstep. it keeps its own random state,
+// as workers started at the same moment would otherwise share one sequence
+static
+int s_mdwrk_next_reconnect_delay(mdwrk_t* self)
+{
+    self->jitter_seed = self->jitter_seed * 6364136223846793005ULL
+        + 1442695040888963407ULL;
+    int span = self->reconnect_delay * 3 - self->reconnect_base;
+    if (span < 0)
+        span = 0;
+    int delay = self->reconnect_base
+        + (int)((self->jitter_seed >> 33) % (uint64_t)(span + 1));
+    int max = self->reconnect_base > RECONNECT_DELAY_MAX
+        ? self->reconnect_base : RECONNECT_DELAY_MAX;
+    return delay < max ? delay : max;
 }
 
 // connect or reconnect to broker
@@ -65,7 +89,6 @@ void s_mdwrk_connect_to_broker(mdwrk_t* self)
     s_mdwrk_send_to_broker(self, MDPW_READY, self->service, NULL);
     // if liveness hits zero, broker is considered disconnected
     self->liveness = HEARTBEAT_LIVENESS;
-    self->heartbeat_at = zclock_time() + self->heartbeat_intv;
 }
 
 // constructor
@@ -81,6 +104,9 @@ mdwrk_t* mdwrk_new(const char* broker, const char* service, int verbose)
     self->verbose = verbose;
     self->heartbeat_intv = HEARTBEAT_INTERVAL;     // msec
     self->reconnect_delay = RECONNECT_DELAY_INIT;  // msec
+    self->reconnect_base = RECONNECT_DELAY_INIT;
+    self->jitter_seed = (uint64_t)zclock_time() ^ (uint64_t)(size_t)self
+        ^ ((uint64_t)getpid() << 32);
     self->expect_reply = 0;
     self->reply_to = NULL;
 
@@ -111,7 +137,9 @@ void mdwrk_set_heartbeat_intv(mdwrk_t* self, int heartbeat_intv)
 void mdwrk_set_reconnect_delay(mdwrk_t* self, int reconnect_delay)
 {
     assert(self);
+    assert(reconnect_delay >= 0);
     self->reconnect_delay = reconnect_delay;
+    self->reconnect_base = reconnect_delay;
 }
 
 // flush last pending reply to broker, and receive a request
@@ -141,7 +169,7 @@ zmsg_t* mdwrk_recv(mdwrk_t* self, zmsg_t** reply_p)
                 break;
 
             self->liveness = HEARTBEAT_LIVENESS;
-            self->reconnect_delay = RECONNECT_DELAY_INIT;
+            self->reconnect_delay = self->reconnect_base;
 
             // protocol envelope check
             assert(zmsg_size(msg) >= 6);
@@ -169,17 +197,16 @@ zmsg_t* mdwrk_recv(mdwrk_t* self, zmsg_t** reply_p)
                 zclock_log("W: no heartbeat received from broker within %dms",
                         self->heartbeat_intv);
         } else {
+            self->reconnect_delay = s_mdwrk_next_reconnect_delay(self);
             if (self->verbose)
                 zclock_log("E: broker considered offline, reconnect after %dms",
                         self->reconnect_delay);
             s_mdwrk_send_to_broker(self, MDPW_DISCONNECT, NULL, NULL);
             zclock_sleep(self->reconnect_delay);
-            if (self->reconnect_delay < RECONNECT_DELAY_MAX)
-                self->reconnect_delay *= 2;
             s_mdwrk_connect_to_broker(self);
         }
 
-        // send heartbeat if it's time
+        // send heartbeat if nothing was sent within the last interval
         if (zclock_time() >= self->heartbeat_at) {
             s_mdwrk_send_to_broker(self, MDPW_HEARTBEAT, NULL, NULL);
             self->heartbeat_at = zclock_time() + self->heartbeat_intv;
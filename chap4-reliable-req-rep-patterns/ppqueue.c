@@ -7,90 +7,120 @@
 #include <czmq.h>
 #include <assert.h>
 
+#include "ppworkers.h"
+#include "slab.h"
+
 static const int HEARTBEAT_LIVENESS = 3;     // 3-5 is reasonable
 static const int HEARTBEAT_INTERVAL = 1000;  // msecs
+static const int HEARTBEAT_TICKS = 4;        // Heartbeat passes per interval
+static const int READY_BUDGET = 500;         // READYs accepted per interval
+static const int REQUEST_QUEUE_MAX = 10000;  // Requests waiting for workers
+static const int REQUEST_MAX_AGE = 2500;     // msecs, as long as clients wait
 // Paranoid Pirate Protocol constants
 static const char PPP_READY[]     = "\001";  // Signals worker is ready
 static const char PPP_HEARTBEAT[] = "\002";  // Signals worker heartbeat
+static const char PPP_BACKOFF[]   = "\003";  // Tells worker when to retry READY
 
-// Here we define the worker class; a structure and a set of functions that
-// act as constructor, destructor, and methods on worker objects:
-
-typedef struct {
-    zframe_t* identity;  // Identity frame of worker
-    char* id_string;     // Printable identity
-    uint64_t expiry;     // Expires at this time
-} worker_t;
+// Ready workers are kept in a LRU queue indexed by identity, see ppworkers.c,
+// so that finding, queueing and purging a worker never scans the queue.
+//
+// The ready method puts a worker to the end of the ready queue, refreshing its
+// expiry. A worker comes back to the queue either with its first READY or with
+// a reply to the request we just sent it, so either way it needn't hear from us
+// for a whole interval. An idle worker's own heartbeats must not postpone ours
+// though, so a worker already queued keeps its heartbeat schedule:
 
-// Construct new worker
-static worker_t* s_worker_new(zframe_t* identity)
+static ppworker_t* s_worker_ready(ppworkers_t* workers, zframe_t* identity)
 {
-    worker_t* self = (worker_t*)zmalloc(sizeof(worker_t));
-    assert(self);
-    self->identity = identity;
-    self->id_string = zframe_strdup(identity);
-    self->expiry = zclock_time() + HEARTBEAT_LIVENESS * HEARTBEAT_INTERVAL;
-    return self;
+    ppworker_t* worker = ppworkers_ready(workers, identity);
+    worker->expiry = zclock_time() + HEARTBEAT_LIVENESS * HEARTBEAT_INTERVAL;
+    if (!worker->heartbeat_at)
+        worker->heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
+    return worker;
 }
-// Destroy specified worker object, including identity frame
-static void s_worker_destroy(worker_t** self_p)
+
+// The backoff method tells a worker, whose READY we won't take now, how many
+// msecs to wait before sending READY again:
+
+static void s_worker_backoff(zframe_t* identity, int delay, void* backend)
 {
-    assert(self_p);
-    if (*self_p) {
-        worker_t* self = *self_p;
-        zframe_destroy(&self->identity);
-        free(self->id_string);
-        free(self);
-        *self_p = NULL;
-    }
+    zmsg_t* msg = zmsg_new();
+    zmsg_addmem(msg, PPP_BACKOFF, 1);
+    zmsg_addstrf(msg, "%d", delay);
+    zmsg_push(msg, identity);
+    zmsg_send(&msg, backend);
 }
 
-// The ready method puts a worker to the end of the ready list, to mimic a
-// LRU queue of workers; remove the existing worker from the queue first if
-// necessary:
+// Client requests wait in a bounded FIFO queue until a worker is ready. The
+// queue is drained from the frontend at all times, so requests don't pile up
+// unseen in the socket, and a request which can't be served - the queue is
+// full, or it has waited longer than the client would - is answered with an
+// explicit rejection instead of being dropped:
 
-static void s_worker_ready(worker_t* self, zlist_t* workers)
+typedef struct _request_t request_t;
+struct _request_t {
+    request_t* next;     // Newer request, reused by the pool once freed
+    zmsg_t* msg;         // Client request, with its envelope
+    uint64_t queued_at;  // Arrived at this time
+};
+
+typedef struct {
+    request_t* head;     // Oldest request
+    request_t* tail;     // Newest request
+    int size;
+    slab_t* pool;        // Request objects
+} requests_t;
+
+static const char REQUEST_REJECTED_FULL[] = "E: queue full";
+static const char REQUEST_REJECTED_EXPIRED[] = "E: request expired";
+
+// Reply to the client with the rejection reason in place of the request body
+static void s_request_reject(zmsg_t* msg, const char* reason, void* frontend)
 {
-    worker_t* worker = (worker_t*)zlist_first(workers);
-    while (worker) {
-        if (streq(worker->id_string, self->id_string)) {
-            zlist_remove(workers, worker);
-            s_worker_destroy(&worker);
-            break;
-        }
-        worker = (worker_t*)zlist_next(workers);
-    }
-    zlist_append(workers, self);
+    zframe_reset(zmsg_last(msg), reason, strlen(reason));
+    zmsg_send(&msg, frontend);
 }
 
-// The next method returns the next available worker identity:
+static void s_requests_push(requests_t* self, zmsg_t* msg, uint64_t now)
+{
+    request_t* request = (request_t*)slab_alloc(self->pool);
+    request->msg = msg;
+    request->queued_at = now;
+    if (self->tail)
+        self->tail->next = request;
+    else
+        self->head = request;
+    self->tail = request;
+    self->size++;
+}
 
-static zframe_t* s_workers_next(zlist_t* workers)
+// Take the oldest request off the queue, and tell how long it waited
+static zmsg_t* s_requests_pop(requests_t* self, uint64_t now, int* waited)
 {
-    worker_t* worker = (worker_t*)zlist_pop(workers);
-    zframe_t* identity = worker->identity;
-    worker->identity = NULL;  // make sure the returned identity frame do not
-                              // get destroied in 's_worker_destroy'
-    s_worker_destroy(&worker);
-    return identity;
+    request_t* request = self->head;
+    self->head = request->next;
+    if (!self->head)
+        self->tail = NULL;
+    self->size--;
+    zmsg_t* msg = request->msg;
+    *waited = (int)(now - request->queued_at);
+    slab_free(self->pool, request);
+    return msg;
 }
 
-// The purge method searchers for and kills expired workers. Workers are
-// stored in a LRU-like queue, so we stop at the first alive worker:
-//
-static void s_workers_purge(zlist_t* workers)
+// Reject requests which have waited too long, oldest first; returns how many
+static int s_requests_expire(requests_t* self, uint64_t now, void* frontend)
 {
-    worker_t* worker = (worker_t*)zlist_first(workers);
-    while (worker) {
-        if (zclock_time() < worker->expiry)
-            break;
-        zlist_remove(workers, worker);
-        s_worker_destroy(&worker);
-        worker = (worker_t*)zlist_next(workers);
+    int expired = 0;
+    while (self->head && now >= self->head->queued_at + REQUEST_MAX_AGE) {
+        int waited;
+        zmsg_t* msg = s_requests_pop(self, now, &waited);
+        s_request_reject(msg, REQUEST_REJECTED_EXPIRED, frontend);
+        expired++;
     }
+    return expired;
 }
 
-
 // The main task is a load-balancer with heartbeating on workers so that we
 // can detect crashed or blocked worker tasks:
 //
@@ -102,18 +132,42 @@ int main()
     zsocket_bind(backend, "tcp://*:5556");   // For workers
     zsocket_bind(frontend, "tcp://*:5555");  // For clients
 
-    // List of available workers
-    zlist_t* workers = zlist_new();
-    // Send out heartbeat at regular interval
-    uint64_t heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
+    // Queue of available workers
+    ppworkers_t* workers = ppworkers_new();
+    // Queue of requests waiting for workers
+    requests_t requests = { NULL, NULL, 0, NULL };
+    requests.pool = slab_new(sizeof(request_t), 256);
+    // Heartbeats are due per worker, but emitted in batches: a few times per
+    // interval we walk the idle workers and ping only those we haven't talked
+    // to for a whole interval, reusing a single heartbeat frame
+    int heartbeat_tick = HEARTBEAT_INTERVAL / HEARTBEAT_TICKS;
+    uint64_t heartbeat_at = zclock_time() + heartbeat_tick;
+    zframe_t* heartbeat = zframe_new(PPP_HEARTBEAT, 1);
+    // Control message counters, reported once per interval
+    uint64_t stats_at = zclock_time() + HEARTBEAT_INTERVAL;
+    int heartbeats_sent = 0;
+    int heartbeats_received = 0;
+    int requests_dispatched = 0;
+    int requests_rejected = 0;
+    int requests_expired = 0;
+    int64_t queue_delay_total = 0;
+    int queue_delay_max = 0;
+    // After a restart every worker comes back at once, so READY messages are
+    // admitted on a budget per interval; the excess is told when to retry,
+    // spreading them over the following intervals
+    uint64_t ready_window_at = 0;
+    int readies_admitted = 0;
+    int readies_deferred = 0;
 
     while (1) {
         zmq_pollitem_t items[] = {
             { backend, 0, ZMQ_POLLIN, 0 },
             { frontend, 0, ZMQ_POLLIN, 0 }
         };
-        int rc = zmq_poll(items, zlist_size(workers) ? 2 : 1,
-                HEARTBEAT_INTERVAL * ZMQ_POLL_MSEC);
+        int64_t timeout = (int64_t)(heartbeat_at - zclock_time());
+        if (timeout < 0)
+            timeout = 0;
+        int rc = zmq_poll(items, 2, timeout * ZMQ_POLL_MSEC);
         if (rc == -1)
             break;  // Interrupted
 
@@ -122,53 +176,120 @@ int main()
             if (!msg)
                 break;  // Interrupted
             zframe_t* identity = zmsg_unwrap(msg);
-            worker_t* worker = s_worker_new(identity);
-            s_worker_ready(worker, workers);
-
-            if (zmsg_size(msg) == 1) {
-                zframe_t* frame = zmsg_first(msg);
-                if (memcmp(zframe_data(frame), PPP_READY, 1) != 0 &&
-                        memcmp(zframe_data(frame), PPP_HEARTBEAT, 1) != 0) {
-                    printf("E: invalid control message from worker");
-                    zmsg_dump(msg);
-                }
+            int is_ready = zmsg_size(msg) == 1 &&
+                memcmp(zframe_data(zmsg_first(msg)), PPP_READY, 1) == 0;
+            if (is_ready && zclock_time() >= ready_window_at) {
+                ready_window_at = zclock_time() + HEARTBEAT_INTERVAL;
+                if (readies_deferred)
+                    printf("I: %d workers admitted, %d deferred\n",
+                            readies_admitted, readies_deferred);
+                readies_admitted = readies_deferred = 0;
+            }
+            if (is_ready && readies_admitted >= READY_BUDGET) {
+                int delay = (1 + readies_deferred / READY_BUDGET)
+                    * HEARTBEAT_INTERVAL + randof(HEARTBEAT_INTERVAL);
+                readies_deferred++;
                 zmsg_destroy(&msg);
+                s_worker_backoff(identity, delay, backend);
             } else {
-                zmsg_send(&msg, frontend);
+                if (is_ready)
+                    readies_admitted++;
+                s_worker_ready(workers, identity);
+                zframe_destroy(&identity);
+
+                if (zmsg_size(msg) == 1) {
+                    zframe_t* frame = zmsg_first(msg);
+                    if (memcmp(zframe_data(frame), PPP_HEARTBEAT, 1) == 0) {
+                        heartbeats_received++;
+                    } else if (!is_ready) {
+                        printf("E: invalid control message from worker");
+                        zmsg_dump(msg);
+                    }
+                    zmsg_destroy(&msg);
+                } else {
+                    zmsg_send(&msg, frontend);
+                }
             }
         }
         if (items[1].revents & ZMQ_POLLIN) {
-            // Get the next client request, route to next worker
+            // Get the next client request, queue it for the next worker
             zmsg_t* msg = zmsg_recv(frontend);
             if (!msg)
                 break;  // Interrupted
-            zmsg_push(msg, s_workers_next(workers));
+            if (requests.size < REQUEST_QUEUE_MAX) {
+                s_requests_push(&requests, msg, zclock_time());
+            } else {
+                s_request_reject(msg, REQUEST_REJECTED_FULL, frontend);
+                requests_rejected++;
+            }
+        }
+
+        // Route queued requests, oldest first, to as many workers as are
+        // ready, and reject the ones which have waited too long
+        requests_expired +=
+            s_requests_expire(&requests, zclock_time(), frontend);
+        while (requests.size && ppworkers_size(workers)) {
+            int waited;
+            zmsg_t* msg = s_requests_pop(&requests, zclock_time(), &waited);
+            ppworker_t* worker = ppworkers_pop(workers);
+            zmsg_pushmem(msg, worker->identity, worker->identity_size);
             zmsg_send(&msg, backend);
+            requests_dispatched++;
+            queue_delay_total += waited;
+            if (waited > queue_delay_max)
+                queue_delay_max = waited;
         }
 
         // Handle heartbeating after any socket activity. First, send heartbeat
-        // signal to any idle workers if it's time. Then, purge any dead
+        // signal to the idle workers which are due. Then, purge any dead
         // workers:
-        if (zclock_time() >= heartbeat_at) {
-            worker_t* worker = (worker_t*)zlist_first(workers);
+        uint64_t now = zclock_time();
+        if (now >= heartbeat_at) {
+            ppworker_t* worker = ppworkers_first(workers);
             while (worker) {
-                printf("I: heartbeat to worker (%s)\n", worker->id_string);
-                zframe_send(&worker->identity, backend,
-                        ZFRAME_REUSE + ZFRAME_MORE);
-                zframe_t* frame = zframe_new(PPP_HEARTBEAT, 1);
-                zframe_send(&frame, backend, 0);
-                worker = (worker_t*)zlist_next(workers);
+                if (now >= worker->heartbeat_at) {
+                    zmq_send(backend, worker->identity, worker->identity_size,
+                            ZMQ_SNDMORE);
+                    zframe_send(&heartbeat, backend, ZFRAME_REUSE);
+                    worker->heartbeat_at = now + HEARTBEAT_INTERVAL;
+                    heartbeats_sent++;
+                }
+                worker = worker->next;
             }
-            heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
+            heartbeat_at = now + heartbeat_tick;
+        }
+        ppworkers_purge(workers, now);
+
+        if (now >= stats_at) {
+            if (heartbeats_sent || heartbeats_received)
+                printf("I: %d workers idle, heartbeats: %d sent, %d "
+                        "received, %d worker slabs\n",
+                        (int)ppworkers_size(workers), heartbeats_sent,
+                        heartbeats_received,
+                        (int)ppworkers_pool(workers)->heap_allocs);
+            if (requests_dispatched || requests.size || requests_rejected
+                    || requests_expired)
+                printf("I: requests: %d dispatched, %d queued, %d rejected, "
+                        "%d expired, queueing delay avg %d max %d msec\n",
+                        requests_dispatched, requests.size, requests_rejected,
+                        requests_expired, requests_dispatched
+                        ? (int)(queue_delay_total / requests_dispatched) : 0,
+                        queue_delay_max);
+            heartbeats_sent = heartbeats_received = 0;
+            requests_dispatched = requests_rejected = requests_expired = 0;
+            queue_delay_total = queue_delay_max = 0;
+            stats_at = now + HEARTBEAT_INTERVAL;
         }
-        s_workers_purge(workers);
     }
     // Clean up properly when we're done
-    while (zlist_size(workers)) {
-        worker_t* worker = (worker_t*)zlist_pop(workers);
-        s_worker_destroy(&worker);
+    while (requests.size) {
+        int waited;
+        zmsg_t* msg = s_requests_pop(&requests, zclock_time(), &waited);
+        zmsg_destroy(&msg);
     }
-    zlist_destroy(&workers);
+    slab_destroy(&requests.pool);
+    ppworkers_destroy(&workers);
+    zframe_destroy(&heartbeat);
 
     zctx_destroy(&ctx);
     return 0;
@@ -0,0 +1,286 @@
+/**
+ * @file ppsim.c
+ *
+ * @breif Paranoid Pirate worker simulator
+ * Plugs a large number of lightweight PPP workers, plus one client, into a
+ * running ppqueue from a single thread. Two scenarios are supported:
+ *
+ *   ppsim heartbeat [workers] [seconds] [requests/sec]
+ *      Counts the control messages exchanged in both directions, to see how
+ *      heartbeat traffic scales with the number of workers.
+ *
+ *   ppsim restart [workers] [jitter|doubling]
+ *      Waits for all workers to be taken in, then for ppqueue to be killed
+ *      and restarted by hand, and measures how long the new queue takes to
+ *      get back to full capacity. Restart the queue only once ppsim reports
+ *      that every worker has noticed it was gone.
+ *
+ * Every worker is a DEALER socket with its own TCP connection, so raise the
+ * open files limit (ulimit -n) before simulating thousands of them.
+ */
+#include <czmq.h>
+#include <assert.h>
+
+static const int HEARTBEAT_LIVENESS = 3;     // 3-5 is reasonable
+static const int HEARTBEAT_INTERVAL = 1000;  // msecs
+static const int INTERVAL_INIT = 1000;   // Initial reconnect interval
+static const int INTERVAL_MAX = 32000;   // After backoff
+// Paranoid Pirate Protocol constants
+static const char PPP_READY[]     = "\001";  // Signals worker is ready
+static const char PPP_HEARTBEAT[] = "\002";  // Signals worker heartbeat
+static const char PPP_BACKOFF[]   = "\003";  // Queue asks to retry READY later
+
+static const char QUEUE_BACKEND[]  = "tcp://127.0.0.1:5556";
+static const char QUEUE_FRONTEND[] = "tcp://127.0.0.1:5555";
+
+// Simulated worker, it replies at once and otherwise behaves like ppworker:
+// heartbeats only when it has sent nothing else within the last interval,
+// reconnects with backoff when the queue goes silent, and honours BACKOFF
+
+typedef struct {
+    void* socket;
+    uint64_t heartbeat_at;  // Heartbeat the queue at this time
+    uint64_t silent_at;     // Queue is considered dead at this time
+    uint64_t retry_at;      // Send READY at this time, if not zero
+    int reconnect;          // Replace the socket before retrying
+    int interval;           // Reconnect interval
+    int accepted;           // Has been heartbeated by the queue
+} sim_worker_t;
+
+// Counters of the messages seen during the simulation
+typedef struct {
+    int heartbeats_in;   // Heartbeats from queue to workers
+    int heartbeats_out;  // Heartbeats from workers to queue
+    int readies;         // READY messages sent
+    int backoffs;        // BACKOFF messages received
+    int requests;        // Requests sent by the client
+    int replies;         // Replies received by the client
+    int accepted;        // Workers currently accepted by the queue
+} sim_stats_t;
+
+static int jittered = 1;  // Jittered or plain doubling backoff
+
+static int s_next_interval(int interval)
+{
+    int next;
+    if (jittered)
+        next = INTERVAL_INIT + randof(interval * 3 - INTERVAL_INIT + 1);
+    else
+        next = interval * 2;
+    return next < INTERVAL_MAX ? next : INTERVAL_MAX;
+}
+
+static void* s_sim_worker_socket(zctx_t* ctx, int index)
+{
+    void* socket = zsocket_new(ctx, ZMQ_DEALER);
+    char identity[16];
+    sprintf(identity, "sim-%05d", index);
+    zmq_setsockopt(socket, ZMQ_IDENTITY, identity, strlen(identity));
+    zsocket_connect(socket, QUEUE_BACKEND);
+    return socket;
+}
+
+static void s_sim_worker_ready(sim_worker_t* worker, sim_stats_t* stats)
+{
+    zframe_t* ready = zframe_new(PPP_READY, 1);
+    zframe_send(&ready, worker->socket, 0);
+    stats->readies++;
+    worker->heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
+    worker->silent_at = zclock_time() + HEARTBEAT_LIVENESS * HEARTBEAT_INTERVAL;
+}
+
+static void s_sim_worker_recv(sim_worker_t* worker, sim_stats_t* stats)
+{
+    zmsg_t* msg = zmsg_recv(worker->socket);
+    if (!msg)
+        return;
+    uint64_t now = zclock_time();
+    worker->silent_at = now + HEARTBEAT_LIVENESS * HEARTBEAT_INTERVAL;
+    worker->interval = INTERVAL_INIT;
+
+    if (zmsg_size(msg) == 3) {
+        zmsg_send(&msg, worker->socket);
+        worker->heartbeat_at = now + HEARTBEAT_INTERVAL;
+    } else if (zmsg_size(msg) == 2
+            && memcmp(zframe_data(zmsg_first(msg)), PPP_BACKOFF, 1) == 0) {
+        char* delay = zframe_strdup(zmsg_last(msg));
+        worker->retry_at = now + atoi(delay);
+        worker->reconnect = 0;
+        stats->backoffs++;
+        free(delay);
+    } else if (zmsg_size(msg) == 1
+            && memcmp(zframe_data(zmsg_first(msg)), PPP_HEARTBEAT, 1) == 0) {
+        stats->heartbeats_in++;
+        if (!worker->accepted) {
+            worker->accepted = 1;
+            stats->accepted++;
+        }
+    }
+    zmsg_destroy(&msg);
+}
+
+// Heartbeat or reconnect the worker if it's time, returns the new socket
+// if the worker had to reconnect
+static void* s_sim_worker_tick(sim_worker_t* worker, int index,
+                               zctx_t* ctx, sim_stats_t* stats)
+{
+    void* socket = NULL;
+    uint64_t now = zclock_time();
+    if (worker->retry_at) {
+        if (now >= worker->retry_at) {
+            if (worker->reconnect) {
+                zsocket_destroy(ctx, worker->socket);
+                worker->socket = socket = s_sim_worker_socket(ctx, index);
+            }
+            worker->retry_at = 0;
+            s_sim_worker_ready(worker, stats);
+        }
+    } else if (now >= worker->silent_at) {
+        // Queue is gone, back off before reconnecting
+        if (worker->accepted) {
+            worker->accepted = 0;
+            stats->accepted--;
+        }
+        worker->interval = s_next_interval(worker->interval);
+        worker->retry_at = now + worker->interval;
+        worker->reconnect = 1;
+    } else if (now > worker->heartbeat_at) {
+        zframe_t* heartbeat = zframe_new(PPP_HEARTBEAT, 1);
+        zframe_send(&heartbeat, worker->socket, 0);
+        worker->heartbeat_at = now + HEARTBEAT_INTERVAL;
+        stats->heartbeats_out++;
+    }
+    return socket;
+}
+
+int main(int argc, char* argv[])
+{
+    int restart = argc > 1 && streq(argv[1], "restart");
+    if (argc < 2 || (!restart && !streq(argv[1], "heartbeat"))) {
+        printf("syntax: ppsim heartbeat [workers] [seconds] [requests/sec]\n");
+        printf("        ppsim restart [workers] [jitter|doubling]\n");
+        return 0;
+    }
+    int nbr_workers = argc > 2 ? atoi(argv[2]) : (restart ? 5000 : 1000);
+    int seconds = !restart && argc > 3 ? atoi(argv[3]) : 10;
+    int rate = !restart && argc > 4 ? atoi(argv[4]) : 0;
+    if (restart && argc > 3)
+        jittered = !streq(argv[3], "doubling");
+    if (nbr_workers <= 0 || seconds <= 0 || rate < 0) {
+        printf("E: invalid arguments\n");
+        return 1;
+    }
+    srandom((unsigned int)time(0));
+    if (restart)
+        printf("I: simulating %d workers with %s backoff...\n",
+                nbr_workers, jittered ? "jittered" : "doubling");
+    else
+        printf("I: simulating %d workers for %d seconds, %d requests/sec...\n",
+                nbr_workers, seconds, rate);
+
+    zctx_t* ctx = zctx_new();
+    void* client = zsocket_new(ctx, ZMQ_DEALER);
+    zsocket_connect(client, QUEUE_FRONTEND);
+
+    // Poll item 0 is the client, the rest are workers in order
+    sim_stats_t stats = { 0 };
+    sim_worker_t* workers =
+        (sim_worker_t*)zmalloc(nbr_workers * sizeof(sim_worker_t));
+    zmq_pollitem_t* items =
+        (zmq_pollitem_t*)zmalloc((nbr_workers + 1) * sizeof(zmq_pollitem_t));
+    items[0].socket = client;
+    items[0].events = ZMQ_POLLIN;
+    for (int i = 0; i < nbr_workers; ++i) {
+        workers[i].socket = s_sim_worker_socket(ctx, i);
+        workers[i].interval = INTERVAL_INIT;
+        s_sim_worker_ready(&workers[i], &stats);
+        items[i + 1].socket = workers[i].socket;
+        items[i + 1].events = ZMQ_POLLIN;
+    }
+
+    // In the restart scenario we go through three phases: waiting for all
+    // workers to be accepted, waiting for the queue to go away, and then
+    // measuring how long the restarted queue takes to accept everyone
+    enum { PHASE_JOIN, PHASE_LOST, PHASE_REJOIN } phase = PHASE_JOIN;
+    uint64_t start = zclock_time();
+    uint64_t end = start + seconds * 1000;
+    uint64_t rejoin_at = 0;
+    int readies_at_rejoin = 0;
+    int backoffs_at_rejoin = 0;
+    while (!zctx_interrupted) {
+        uint64_t now = zclock_time();
+        if (!restart && now >= end)
+            break;
+
+        // Keep the client at the requested rate
+        int due = (int)((now - start) * rate / 1000);
+        while (stats.requests < due) {
+            zstr_sendm(client, "");
+            zstr_send(client, "request");
+            stats.requests++;
+        }
+
+        int rc = zmq_poll(items, nbr_workers + 1, 10 * ZMQ_POLL_MSEC);
+        if (rc == -1)
+            break;  // Interrupted
+
+        if (items[0].revents & ZMQ_POLLIN) {
+            zmsg_t* reply = zmsg_recv(client);
+            if (reply)
+                stats.replies++;
+            zmsg_destroy(&reply);
+        }
+        for (int i = 0; i < nbr_workers; ++i) {
+            if (items[i + 1].revents & ZMQ_POLLIN)
+                s_sim_worker_recv(&workers[i], &stats);
+            void* socket = s_sim_worker_tick(&workers[i], i, ctx, &stats);
+            if (socket)
+                items[i + 1].socket = socket;
+        }
+        if (!restart)
+            continue;
+
+        now = zclock_time();
+        if (phase == PHASE_JOIN && stats.accepted == nbr_workers) {
+            printf("I: all %d workers accepted after %d msec\n",
+                    nbr_workers, (int)(now - start));
+            printf("I: now kill ppqueue...\n");
+            phase = PHASE_LOST;
+        } else if (phase == PHASE_LOST && stats.accepted == 0) {
+            printf("I: all workers lost the queue, now restart it...\n");
+            phase = PHASE_REJOIN;
+        } else if (phase == PHASE_REJOIN && stats.accepted > 0) {
+            if (!rejoin_at) {
+                rejoin_at = now;
+                readies_at_rejoin = stats.readies;
+                backoffs_at_rejoin = stats.backoffs;
+            }
+            if (stats.accepted == nbr_workers) {
+                printf("I: full capacity %d msec after first worker rejoined, "
+                        "%d READY sent, %d BACKOFF received\n",
+                        (int)(now - rejoin_at),
+                        stats.readies - readies_at_rejoin,
+                        stats.backoffs - backoffs_at_rejoin);
+                break;
+            }
+        }
+    }
+
+    if (!restart) {
+        double elapsed = (zclock_time() - start) / 1000.0;
+        int control = stats.heartbeats_in + stats.heartbeats_out;
+        printf("I: %d requests, %d replies in %.1f seconds\n",
+                stats.requests, stats.replies, elapsed);
+        printf("I: heartbeats: %d from queue, %d to queue\n",
+                stats.heartbeats_in, stats.heartbeats_out);
+        printf("I: %.1f control messages/sec, %.3f per worker/sec, "
+                "%.3f per reply\n", control / elapsed,
+                control / elapsed / nbr_workers,
+                stats.replies ? (double)control / stats.replies : 0.0);
+    }
+
+    free(items);
+    free(workers);
+    zctx_destroy(&ctx);
+    return 0;
+}
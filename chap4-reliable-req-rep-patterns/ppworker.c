@@ -9,11 +9,12 @@
 static const int HEARTBEAT_LIVENESS = 3;     // 3-5 is reasonable
 static const int HEARTBEAT_INTERVAL = 1000;  // msecs
 static const int INTERVAL_INIT = 1000;   // Initial reconnect interval
-static const int INTERVAL_MAX = 32000;   // After exponential backoff
+static const int INTERVAL_MAX = 32000;   // After jittered backoff
 
 // Paranoid Pirate Protocol constants
 static const char PPP_READY[] = "\001";  // Signals worker is ready
 static const char PPP_HEARTBEAT[] = "\002";  // Signals worker heartbeat
+static const char PPP_BACKOFF[] = "\003";  // Queue asks to retry READY later
 
 static char identity[10] = {0};
 
@@ -35,10 +36,21 @@ static void* s_worker_socket(zctx_t* ctx)
     return worker;
 }
 
+// Decorrelated jitter backoff: the next interval is picked at random between
+// the initial interval and three times the last one. Workers which lost the
+// queue at the same moment thus spread out, instead of all reconnecting in
+// lockstep and flooding the restarted queue with READY messages:
+
+static int s_next_interval(int interval)
+{
+    int next = INTERVAL_INIT + randof(interval * 3 - INTERVAL_INIT + 1);
+    return next < INTERVAL_MAX ? next : INTERVAL_MAX;
+}
+
 int main()
 {
     zctx_t* ctx = zctx_new();
-    srandom((unsigned int)time(0));
+    srandom((unsigned int)time(0) ^ (unsigned int)getpid());
     void* worker = s_worker_socket(ctx);
     printf("I: (%s) worker ready\n", identity);
 
@@ -60,6 +72,7 @@ int main()
 
             // Message from queue
             // 3-part envelope + content -> request
+            // 2-part BACKOFF + delay -> READY deferred by queue
             // 1-part HEARTBEAT -> heartbeat
             if (zmsg_size(msg) == 3) {
                 cycles++;
@@ -75,6 +88,22 @@ int main()
                 zclock_sleep(1000);
                 zmsg_send(&msg, worker);
                 liveness = HEARTBEAT_LIVENESS;
+                // The reply tells the queue we're alive as well as a
+                // heartbeat would, so skip the next one
+                heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
+            } else if (zmsg_size(msg) == 2 &&
+                    memcmp(zframe_data(zmsg_first(msg)), PPP_BACKOFF, 1) == 0) {
+                // The queue is taking in too many workers at once, and told
+                // us when to announce ourselves again
+                char* delay = zframe_strdup(zmsg_last(msg));
+                printf("W: queue is busy, READY again in %s msec...\n", delay);
+                zclock_sleep(atoi(delay));
+                free(delay);
+                zframe_t* ready = zframe_new(PPP_READY, 1);
+                zframe_send(&ready, worker, 0);
+                liveness = HEARTBEAT_LIVENESS;
+                heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
+                zmsg_destroy(&msg);
             } else if (zmsg_size(msg) == 1) {
                 zframe_t* frame = zmsg_first(msg);
                 if (memcmp(zframe_data(frame), PPP_HEARTBEAT, 1) == 0) {
@@ -96,16 +125,16 @@ int main()
         // of discarding any messages we might have sent in the meantime:
         if (--liveness == 0) {
             printf("W: heartbeat failure, can't reach queue\n");
+            interval = s_next_interval(interval);
             printf("W: reconnecting in %d msec...\n", interval);
             zclock_sleep(interval);
 
-            if (interval < INTERVAL_MAX)
-                interval *= 2;
             zsocket_destroy(ctx, worker);
             worker = s_worker_socket(ctx);
             liveness = HEARTBEAT_LIVENESS;
         }
-        // Send heartbeat to the queue if it's time
+        // Send heartbeat to the queue if we haven't sent it anything within
+        // the last interval
         if (zclock_time() > heartbeat_at) {
             heartbeat_at = zclock_time() + HEARTBEAT_INTERVAL;
             printf("I: worker heartbeat\n");
@@ -0,0 +1,198 @@
+// ppworkers.c
+//
+// Paranoid Pirate worker set
+// Ready workers live in an intrusive doubly-linked LRU queue, and are found
+// by identity through a chained hash index whose chains are linked through
+// the workers themselves. Worker objects come from a slab pool: popped and
+// purged ones are given back and recycled, so once the set has grown to its
+// peak size it performs no heap allocations.
+//
+#include "ppworkers.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define INDEX_INIT_SIZE 64  // Buckets, always a power of two
+#define WORKERS_PER_SLAB 256
+
+struct _ppworkers_t {
+    ppworker_t* head;       // Least recently used ready worker
+    ppworker_t* tail;       // Most recently used ready worker
+    size_t size;            // Number of ready workers
+    ppworker_t** index;     // Hash index buckets
+    size_t index_size;
+    slab_t* pool;           // Worker objects
+};
+
+// FNV-1a, identities are short and often differ in the last bytes only
+static size_t s_hash(const byte* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static ppworker_t** s_bucket(ppworkers_t* self, const byte* data, size_t size)
+{
+    return &self->index[s_hash(data, size) & (self->index_size - 1)];
+}
+
+// Double the index once it's fuller than one worker per bucket on average
+static void s_index_grow(ppworkers_t* self)
+{
+    ppworker_t** old_index = self->index;
+    size_t old_size = self->index_size;
+    self->index_size *= 2;
+    self->index = (ppworker_t**)zmalloc(self->index_size * sizeof(ppworker_t*));
+    size_t i;
+    for (i = 0; i < old_size; i++) {
+        ppworker_t* worker = old_index[i];
+        while (worker) {
+            ppworker_t* hash_next = worker->hash_next;
+            ppworker_t** bucket = s_bucket(self, worker->identity,
+                    worker->identity_size);
+            worker->hash_next = *bucket;
+            *bucket = worker;
+            worker = hash_next;
+        }
+    }
+    free(old_index);
+}
+
+static void s_index_remove(ppworkers_t* self, ppworker_t* worker)
+{
+    ppworker_t** link = s_bucket(self, worker->identity, worker->identity_size);
+    while (*link != worker)
+        link = &(*link)->hash_next;
+    *link = worker->hash_next;
+    worker->hash_next = NULL;
+}
+
+static void s_queue_remove(ppworkers_t* self, ppworker_t* worker)
+{
+    if (worker->prev)
+        worker->prev->next = worker->next;
+    else
+        self->head = worker->next;
+    if (worker->next)
+        worker->next->prev = worker->prev;
+    else
+        self->tail = worker->prev;
+    worker->prev = worker->next = NULL;
+}
+
+static void s_queue_append(ppworkers_t* self, ppworker_t* worker)
+{
+    worker->prev = self->tail;
+    worker->next = NULL;
+    if (self->tail)
+        self->tail->next = worker;
+    else
+        self->head = worker;
+    self->tail = worker;
+}
+
+// Forget a queued worker and give its object back to the pool; only its
+// first link gets overwritten, so the identity stays readable until the pool
+// hands the object out again
+static void s_worker_recycle(ppworkers_t* self, ppworker_t* worker)
+{
+    s_index_remove(self, worker);
+    s_queue_remove(self, worker);
+    self->size--;
+    slab_free(self->pool, worker);
+}
+
+ppworkers_t* ppworkers_new(void)
+{
+    ppworkers_t* self = (ppworkers_t*)zmalloc(sizeof(ppworkers_t));
+    self->index_size = INDEX_INIT_SIZE;
+    self->index = (ppworker_t**)zmalloc(self->index_size * sizeof(ppworker_t*));
+    self->pool = slab_new(sizeof(ppworker_t), WORKERS_PER_SLAB);
+    return self;
+}
+
+void ppworkers_destroy(ppworkers_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        ppworkers_t* self = *self_p;
+        slab_destroy(&self->pool);
+        free(self->index);
+        free(self);
+        *self_p = NULL;
+    }
+}
+
+ppworker_t* ppworkers_ready(ppworkers_t* self, zframe_t* identity)
+{
+    assert(self);
+    const byte* data = zframe_data(identity);
+    size_t size = zframe_size(identity);
+    assert(size <= PPWORKER_IDENTITY_MAX);
+
+    ppworker_t** bucket = s_bucket(self, data, size);
+    ppworker_t* worker = *bucket;
+    while (worker) {
+        if (worker->identity_size == size
+                && memcmp(worker->identity, data, size) == 0)
+            break;
+        worker = worker->hash_next;
+    }
+    if (worker) {
+        s_queue_remove(self, worker);
+    } else {
+        worker = (ppworker_t*)slab_alloc(self->pool);
+        memcpy(worker->identity, data, size);
+        worker->identity_size = size;
+        worker->hash_next = *bucket;
+        *bucket = worker;
+        self->size++;
+        if (self->size > self->index_size)
+            s_index_grow(self);
+    }
+    s_queue_append(self, worker);
+    return worker;
+}
+
+ppworker_t* ppworkers_pop(ppworkers_t* self)
+{
+    assert(self);
+    ppworker_t* worker = self->head;
+    if (worker)
+        s_worker_recycle(self, worker);
+    return worker;
+}
+
+int ppworkers_purge(ppworkers_t* self, uint64_t now)
+{
+    assert(self);
+    int purged = 0;
+    while (self->head && now >= self->head->expiry) {
+        s_worker_recycle(self, self->head);
+        purged++;
+    }
+    return purged;
+}
+
+ppworker_t* ppworkers_first(ppworkers_t* self)
+{
+    assert(self);
+    return self->head;
+}
+
+size_t ppworkers_size(ppworkers_t* self)
+{
+    assert(self);
+    return self->size;
+}
+
+const slab_t* ppworkers_pool(ppworkers_t* self)
+{
+    assert(self);
+    return self->pool;
+}
@@ -0,0 +1,58 @@
+// ppworkers.h
+//
+// Paranoid Pirate worker set
+// LRU queue of ready workers, indexed by identity, so that marking a worker
+// ready, picking the next one and purging expired ones are all O(1)
+//
+#ifndef PPWORKERS_H_
+#define PPWORKERS_H_
+
+#include <czmq.h>
+#include "slab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PPWORKER_IDENTITY_MAX 255  // ZeroMQ limit for routing ids
+
+typedef struct _ppworker_t ppworker_t;
+typedef struct _ppworkers_t ppworkers_t;
+
+struct _ppworker_t {
+    // Intrusive links, owned by the worker set; the first one is reused by
+    // the object pool once the worker is recycled
+    ppworker_t* hash_next;  // Chain of the identity index bucket
+    ppworker_t* prev;       // LRU queue, towards the oldest worker
+    ppworker_t* next;       // LRU queue, towards the newest worker
+
+    byte identity[PPWORKER_IDENTITY_MAX];  // Identity of worker
+    size_t identity_size;
+    uint64_t expiry;        // Expires at this time
+    uint64_t heartbeat_at;  // Heartbeat it at this time if still idle,
+                            // zero for a worker which just came back
+};
+
+ppworkers_t* ppworkers_new(void);
+void ppworkers_destroy(ppworkers_t** self_p);
+
+// Put the worker with specified identity at the end of the queue, taking a
+// recycled worker object if it's not queued yet
+ppworker_t* ppworkers_ready(ppworkers_t* self, zframe_t* identity);
+// Remove the least recently used worker from the queue and return it; the
+// worker object is recycled, so use it before the next call to ready
+ppworker_t* ppworkers_pop(ppworkers_t* self);
+// Remove expired workers from the head of the queue, returns how many
+int ppworkers_purge(ppworkers_t* self, uint64_t now);
+
+// Least recently used worker, follow 'next' links for the others
+ppworker_t* ppworkers_first(ppworkers_t* self);
+size_t ppworkers_size(ppworkers_t* self);
+// Pool of worker objects, to check allocation counters
+const slab_t* ppworkers_pool(ppworkers_t* self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PPWORKERS_H_
@@ -0,0 +1,161 @@
+/**
+ * @file ppworkers_bench.c
+ *
+ * @breif Paranoid Pirate worker set benchmark
+ * Replays the queue's worker bookkeeping - a dispatch and a reply plus a
+ * heartbeat from a random idle worker per request - for growing numbers of
+ * workers, against both the indexed LRU of ppworkers.c and the former
+ * zlist-based queue which scans the list on every message. The indexed LRU
+ * must not take anything from the heap once all workers are known; the
+ * benchmark fails if it does.
+ */
+#include <czmq.h>
+#include <assert.h>
+
+#include "ppworkers.h"
+
+static const int SIZES[] = { 10, 100, 1000, 10000, 50000 };
+static const int OPERATIONS = 1000000;     // Requests for the indexed LRU
+static const int LEGACY_BUDGET = 20000000; // Worker visits for the zlist queue
+
+// The former worker class of ppqueue.c, kept here for comparison
+
+typedef struct {
+    zframe_t* identity;  // Identity frame of worker
+    char* id_string;     // Printable identity
+    uint64_t expiry;     // Expires at this time
+} legacy_worker_t;
+
+static legacy_worker_t* s_legacy_new(zframe_t* identity)
+{
+    legacy_worker_t* self = (legacy_worker_t*)zmalloc(sizeof(legacy_worker_t));
+    self->identity = identity;
+    self->id_string = zframe_strdup(identity);
+    self->expiry = zclock_time() + 3000;
+    return self;
+}
+
+static void s_legacy_destroy(legacy_worker_t** self_p)
+{
+    legacy_worker_t* self = *self_p;
+    zframe_destroy(&self->identity);
+    free(self->id_string);
+    free(self);
+    *self_p = NULL;
+}
+
+static void s_legacy_ready(legacy_worker_t* self, zlist_t* workers)
+{
+    legacy_worker_t* worker = (legacy_worker_t*)zlist_first(workers);
+    while (worker) {
+        if (streq(worker->id_string, self->id_string)) {
+            zlist_remove(workers, worker);
+            s_legacy_destroy(&worker);
+            break;
+        }
+        worker = (legacy_worker_t*)zlist_next(workers);
+    }
+    zlist_append(workers, self);
+}
+
+static zframe_t* s_legacy_next(zlist_t* workers)
+{
+    legacy_worker_t* worker = (legacy_worker_t*)zlist_pop(workers);
+    zframe_t* identity = worker->identity;
+    worker->identity = NULL;
+    free(worker->id_string);
+    free(worker);
+    return identity;
+}
+
+// Workers are named "w-<index>", so the index is found again from identity
+static int s_index_of(const byte* identity)
+{
+    return atoi((const char*)identity + 2);
+}
+
+// Also gives the heap allocations of the pool before and after the requests,
+// which must be the same
+static double s_bench_indexed(zframe_t** identities, int size,
+        uint64_t* allocs_before, uint64_t* allocs_after)
+{
+    ppworkers_t* workers = ppworkers_new();
+    for (int i = 0; i < size; ++i)
+        ppworkers_ready(workers, identities[i])->expiry = UINT64_MAX;
+
+    *allocs_before = ppworkers_pool(workers)->heap_allocs;
+    uint64_t start = zclock_time();
+    for (int i = 0; i < OPERATIONS; ++i) {
+        // Dispatch to the next worker, which replies at once
+        ppworker_t* worker = ppworkers_pop(workers);
+        int index = s_index_of(worker->identity);
+        ppworkers_ready(workers, identities[index])->expiry = UINT64_MAX;
+        // Heartbeat from some idle worker
+        ppworkers_ready(workers, identities[randof(size)]);
+        ppworkers_purge(workers, 0);
+    }
+    uint64_t elapsed = zclock_time() - start;
+    assert(ppworkers_size(workers) == (size_t)size);
+    *allocs_after = ppworkers_pool(workers)->heap_allocs;
+    ppworkers_destroy(&workers);
+    return elapsed * 1000000.0 / OPERATIONS;
+}
+
+static double s_bench_legacy(zframe_t** identities, int size)
+{
+    zlist_t* workers = zlist_new();
+    for (int i = 0; i < size; ++i)
+        s_legacy_ready(s_legacy_new(zframe_dup(identities[i])), workers);
+
+    int operations = LEGACY_BUDGET / size;
+    uint64_t start = zclock_time();
+    for (int i = 0; i < operations; ++i) {
+        zframe_t* identity = s_legacy_next(workers);
+        s_legacy_ready(s_legacy_new(identity), workers);
+        zframe_t* heartbeat = zframe_dup(identities[randof(size)]);
+        s_legacy_ready(s_legacy_new(heartbeat), workers);
+    }
+    uint64_t elapsed = zclock_time() - start;
+    while (zlist_size(workers)) {
+        legacy_worker_t* worker = (legacy_worker_t*)zlist_pop(workers);
+        s_legacy_destroy(&worker);
+    }
+    zlist_destroy(&workers);
+    return elapsed * 1000000.0 / operations;
+}
+
+int main()
+{
+    int max_size = SIZES[sizeof(SIZES) / sizeof(SIZES[0]) - 1];
+    zframe_t** identities = (zframe_t**)zmalloc(max_size * sizeof(zframe_t*));
+    for (int i = 0; i < max_size; ++i) {
+        char identity[16];
+        sprintf(identity, "w-%05d", i);
+        identities[i] = zframe_new(identity, strlen(identity));
+    }
+
+    int failed = 0;
+    printf("%8s %16s %16s %16s\n", "workers", "indexed ns/req",
+            "zlist ns/req", "heap allocs");
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); ++i) {
+        int size = SIZES[i];
+        uint64_t allocs_before, allocs_after;
+        double indexed = s_bench_indexed(identities, size, &allocs_before,
+                &allocs_after);
+        double legacy = s_bench_legacy(identities, size);
+        printf("%8d %16.1f %16.1f %7llu -> %-7llu\n", size, indexed, legacy,
+                (unsigned long long)allocs_before,
+                (unsigned long long)allocs_after);
+        // Steady state, every worker object must have been recycled
+        if (allocs_after != allocs_before) {
+            printf("E: %d workers took %llu more objects from the heap\n",
+                    size, (unsigned long long)(allocs_after - allocs_before));
+            failed = 1;
+        }
+    }
+
+    for (int i = 0; i < max_size; ++i)
+        zframe_destroy(&identities[i]);
+    free(identities);
+    return failed;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file spbench.cpp
+ *
+ * @breif Simple Pirate queue benchmark
+ * Runs a set of workers with uneven service times, and a set of clients
+ * sending requests back to back, against a running spqueue. Reports
+ * throughput, latency, and how evenly requests were spread over workers.
+ * Start spqueue with each policy in turn to compare them:
+ *
+ *   spqueue p2c &
+ *   spbench [workers] [clients] [seconds]
+ */
+#include <czmq.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+const char WORKER_READY[] = "\001";  // Signals worker is ready
+const int MAX_WORKERS = 64;
+const int MAX_CLIENTS = 64;
+
+// Workers and clients run until told to stop over their pipes, then send
+// their counters back over them, so main reads them only once they're final
+
+// Whether the pipe says stop, waiting on socket at most timeout msecs;
+// interrupted counts as stop
+bool s_stopped(void* pipe, void* socket, int timeout)
+{
+    zmq_pollitem_t items[] = {
+        { pipe, 0, ZMQ_POLLIN, 0 },
+        { socket, 0, ZMQ_POLLIN, 0 }
+    };
+    if (zmq_poll(items, 2, timeout * ZMQ_POLL_MSEC) == -1)
+        return true;
+    return (items[0].revents & ZMQ_POLLIN) != 0;
+}
+
+// Worker n takes (n % 4 + 1) msecs per request, so a quarter of the workers
+// are four times slower than another quarter
+void worker_task(void* arg, zctx_t* ctx, void* pipe)
+{
+    int index = (int)(size_t)arg;
+    void* worker = zsocket_new(ctx, ZMQ_REQ);
+    char identity[16];
+    sprintf(identity, "w-%02d", index);
+    zmq_setsockopt(worker, ZMQ_IDENTITY, identity, strlen(identity));
+    zsocket_connect(worker, "tcp://127.0.0.1:5556");
+
+    int served = 0;     // Requests served
+    zframe_t* frame = zframe_new(WORKER_READY, 1);
+    zframe_send(&frame, worker, 0);
+    while (!s_stopped(pipe, worker, -1)) {
+        zmsg_t* msg = zmsg_recv(worker);
+        if (!msg)
+            break;  // Interrupted
+        zclock_sleep(index % 4 + 1);
+        served++;
+        zmsg_send(&msg, worker);
+    }
+    free(zstr_recv(pipe));
+    zstr_send(pipe, "%d", served);
+}
+
+void client_task(void* arg, zctx_t* ctx, void* pipe)
+{
+    void* client = zsocket_new(ctx, ZMQ_REQ);
+    zsocket_connect(client, "tcp://127.0.0.1:5555");
+
+    int replies = 0;            // Replies received
+    int64_t latency = 0;        // Sum of latencies, usecs
+    int64_t latency_max = 0;
+    while (true) {
+        int64_t sent_at = zclock_usecs();
+        zstr_send(client, "request");
+        if (s_stopped(pipe, client, -1))
+            break;
+        char* reply = zstr_recv(client);
+        if (!reply)
+            break;  // Interrupted
+        free(reply);
+        int64_t elapsed = zclock_usecs() - sent_at;
+        replies++;
+        latency += elapsed;
+        if (elapsed > latency_max)
+            latency_max = elapsed;
+    }
+    free(zstr_recv(pipe));
+    zstr_send(pipe, "%d %lld %lld", replies, (long long)latency,
+            (long long)latency_max);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int nbr_workers = argc > 1 ? atoi(argv[1]) : 8;
+    int nbr_clients = argc > 2 ? atoi(argv[2]) : 16;
+    int seconds = argc > 3 ? atoi(argv[3]) : 10;
+    if (nbr_workers < 1 || nbr_workers > MAX_WORKERS
+            || nbr_clients < 1 || nbr_clients > MAX_CLIENTS || seconds < 1) {
+        printf("syntax: spbench [workers] [clients] [seconds]\n");
+        return 0;
+    }
+
+    zctx_t* ctx = zctx_new();
+    zctx_set_linger(ctx, 0);    // Don't wait on requests still queued
+    void* workers[MAX_WORKERS];
+    void* clients[MAX_CLIENTS];
+    for (int i = 0; i < nbr_workers; ++i)
+        workers[i] = zthread_fork(ctx, worker_task, (void*)(size_t)i);
+    zclock_sleep(500);  // Let workers register before clients start
+    for (int i = 0; i < nbr_clients; ++i)
+        clients[i] = zthread_fork(ctx, client_task, (void*)(size_t)i);
+
+    zclock_sleep(seconds * 1000);
+
+    // Stop clients first, so workers serve what was sent; each answers with
+    // its counters once it's stopped
+    int replies[MAX_CLIENTS];
+    int64_t latency[MAX_CLIENTS];
+    int64_t latency_max[MAX_CLIENTS];
+    int served[MAX_WORKERS];
+    for (int i = 0; i < nbr_clients; ++i)
+        zstr_send(clients[i], "STOP");
+    for (int i = 0; i < nbr_clients; ++i) {
+        char* counters = zstr_recv(clients[i]);
+        long long sum = 0, max = 0;
+        replies[i] = 0;
+        if (counters)
+            sscanf(counters, "%d %lld %lld", &replies[i], &sum, &max);
+        latency[i] = sum;
+        latency_max[i] = max;
+        free(counters);
+    }
+    for (int i = 0; i < nbr_workers; ++i)
+        zstr_send(workers[i], "STOP");
+    for (int i = 0; i < nbr_workers; ++i) {
+        char* counters = zstr_recv(workers[i]);
+        served[i] = counters ? atoi(counters) : 0;
+        free(counters);
+    }
+
+    // Throughput and latency, over all clients
+    int total = 0;
+    int64_t total_latency = 0;
+    int64_t max_latency = 0;
+    for (int i = 0; i < nbr_clients; ++i) {
+        total += replies[i];
+        total_latency += latency[i];
+        if (latency_max[i] > max_latency)
+            max_latency = latency_max[i];
+    }
+    printf("I: %d replies, %.1f requests/sec, latency avg %.2f max %.2f msec\n",
+            total, (double)total / seconds,
+            total ? total_latency / 1000.0 / total : 0.0,
+            max_latency / 1000.0);
+
+    // Share of work per worker, and Jain's fairness index over the shares:
+    // 1 when all workers serve the same number of requests, 1/n when a
+    // single one serves them all
+    double sum = 0, sum_squares = 0;
+    for (int i = 0; i < nbr_workers; ++i) {
+        printf("I: worker w-%02d (%d msec) served %d\n",
+                i, i % 4 + 1, served[i]);
+        sum += served[i];
+        sum_squares += (double)served[i] * served[i];
+    }
+    printf("I: fairness index %.3f\n",
+            sum_squares ? sum * sum / (nbr_workers * sum_squares) : 0.0);
+
+    zctx_destroy(&ctx);
+    return 0;
+}
@@ -4,7 +4,19 @@
  * @breif Simple Pirate queue (broker)
  * This is identical to the load-balancing pattern, with no reliability
  * mechanisms. It depends on the client for recovery.
- * Runs forever.
+ * The policy which picks a ready worker for each request is chosen at
+ * startup:
+ *
+ *   spqueue [lru|lifo|random|p2c]
+ *
+ *  - lru, the worker which has been ready the longest (default)
+ *  - lifo, the worker which became ready last, its caches are warmest
+ *  - random, any ready worker
+ *  - p2c, the less loaded of two random ready workers. A ready worker never
+ *    has a request in flight, so load is its smoothed service time
+ * Workers which don't answer a request within WORKER_EXPIRY msecs are taken
+ * for dead, and forgotten, as restarted workers come back under new
+ * identities. Runs forever.
  */
 #include <czmq.h>
 #include <stdio.h>
@@ -13,55 +25,241 @@
 namespace {
 
 const char WORKER_READY[] = "\001";  // Signals worker is ready
+const int WORKER_EXPIRY = 60000;      // msecs a request may take
+const int PURGE_INTERVAL = 1000;      // msecs between looking for dead ones
+
+enum policy_t { POLICY_LRU, POLICY_LIFO, POLICY_RANDOM, POLICY_P2C };
+const char* POLICY_NAMES[] = { "lru", "lifo", "random", "p2c" };
+
+// What we know about a worker, kept across requests
+struct worker_t {
+    zframe_t* identity;       // Identity frame of worker
+    char* key;                // Printable identity, in the table of workers
+    uint64_t dispatched_at;   // Last request sent at this time
+    double service_time;      // Smoothed service time, msecs
+    int served;               // Requests served
+    bool busy;                // Has a request, and is in the busy list
+    worker_t* prev;           // In the busy list
+    worker_t* next;
+};
+
+// Busy workers, in the order they were dispatched to, so the oldest come
+// first; linked through the workers, so a reply takes one out in O(1)
+struct busy_t {
+    worker_t* head;
+    worker_t* tail;
+};
+
+void busy_append(busy_t* busy, worker_t* worker)
+{
+    worker->busy = true;
+    worker->prev = busy->tail;
+    worker->next = 0;
+    if (busy->tail)
+        busy->tail->next = worker;
+    else
+        busy->head = worker;
+    busy->tail = worker;
+}
+
+void busy_unlink(busy_t* busy, worker_t* worker)
+{
+    if (!worker->busy)
+        return;
+    if (worker->prev)
+        worker->prev->next = worker->next;
+    else
+        busy->head = worker->next;
+    if (worker->next)
+        worker->next->prev = worker->prev;
+    else
+        busy->tail = worker->prev;
+    worker->busy = false;
+    worker->prev = worker->next = 0;
+}
+
+// Ready workers, in the order they became ready. A ring buffer lets both
+// ends be taken in O(1) for lru and lifo, and any worker be taken by swapping
+// in the newest one for random and p2c, which don't care about the order
+struct ready_t {
+    worker_t** items;
+    size_t head;
+    size_t size;
+    size_t capacity;  // Always a power of two
+};
+
+worker_t*& ready_at(ready_t* ready, size_t index)
+{
+    return ready->items[(ready->head + index) & (ready->capacity - 1)];
+}
+
+void ready_push(ready_t* ready, worker_t* worker)
+{
+    if (ready->size == ready->capacity) {
+        size_t capacity = ready->capacity ? ready->capacity * 2 : 64;
+        worker_t** items = (worker_t**)zmalloc(capacity * sizeof(worker_t*));
+        for (size_t i = 0; i < ready->size; ++i)
+            items[i] = ready_at(ready, i);
+        free(ready->items);
+        ready->items = items;
+        ready->head = 0;
+        ready->capacity = capacity;
+    }
+    ready->size++;
+    ready_at(ready, ready->size - 1) = worker;
+}
+
+worker_t* ready_take(ready_t* ready, size_t index)
+{
+    worker_t* worker = ready_at(ready, index);
+    if (index == 0) {
+        ready->head = (ready->head + 1) & (ready->capacity - 1);
+    } else {
+        ready_at(ready, index) = ready_at(ready, ready->size - 1);
+    }
+    ready->size--;
+    return worker;
+}
 
+worker_t* ready_next(ready_t* ready, policy_t policy)
+{
+    switch (policy) {
+    case POLICY_LIFO:
+        return ready_take(ready, ready->size - 1);
+    case POLICY_RANDOM:
+        return ready_take(ready, randof(ready->size));
+    case POLICY_P2C: {
+        size_t first = randof(ready->size);
+        size_t second = randof(ready->size);
+        if (ready_at(ready, second)->service_time
+                < ready_at(ready, first)->service_time)
+            first = second;
+        return ready_take(ready, first);
+    }
+    default:
+        return ready_take(ready, 0);
+    }
+}
+
+void worker_destroy(void* argument)
+{
+    worker_t* worker = (worker_t*)argument;
+    zframe_destroy(&worker->identity);
+    free(worker->key);
+    free(worker);
 }
 
-int main()
+// Find a worker by identity, or start knowing it
+worker_t* worker_require(zhash_t* workers, zframe_t* identity)
 {
+    char* key = zframe_strhex(identity);
+    worker_t* worker = (worker_t*)zhash_lookup(workers, key);
+    if (worker) {
+        zframe_destroy(&identity);
+        free(key);
+    } else {
+        worker = (worker_t*)zmalloc(sizeof(worker_t));
+        worker->identity = identity;
+        worker->key = key;
+        zhash_insert(workers, key, worker);
+        zhash_freefn(workers, key, worker_destroy);
+    }
+    return worker;
+}
+
+// Forget workers which got a request and didn't answer in time, the oldest
+// busy ones
+void workers_purge(zhash_t* workers, busy_t* busy)
+{
+    uint64_t now = zclock_time();
+    worker_t* worker = busy->head;
+    while (worker && worker->dispatched_at + WORKER_EXPIRY <= now) {
+        busy_unlink(busy, worker);
+        zhash_delete(workers, worker->key);
+        worker = busy->head;
+    }
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    policy_t policy = POLICY_LRU;
+    if (argc > 1) {
+        int i;
+        for (i = 0; i < 4 && !streq(argv[1], POLICY_NAMES[i]); ++i)
+            ;
+        if (i == 4) {
+            printf("syntax: spqueue [lru|lifo|random|p2c]\n");
+            return 0;
+        }
+        policy = (policy_t)i;
+    }
+    printf("I: dispatching with '%s' policy\n", POLICY_NAMES[policy]);
+    srandom((unsigned int)time(0));
+
     zctx_t* ctx = zctx_new();
     void* frontend = zsocket_new(ctx, ZMQ_ROUTER);
     void* backend = zsocket_new(ctx, ZMQ_ROUTER);
     zsocket_bind(frontend, "tcp://*:5555");  // For clients
     zsocket_bind(backend, "tcp://*:5556");   // For workers
 
-    // Queue of available workers
-    zlist_t* available_workers = zlist_new();
+    // Known workers, the ones available, and the ones with a request
+    zhash_t* workers = zhash_new();
+    ready_t available_workers = { 0, 0, 0, 0 };
+    busy_t busy_workers = { 0, 0 };
 
     while (true) {
         zmq_pollitem_t items[] = {
             { backend, 0, ZMQ_POLLIN, 0 },
             { frontend, 0, ZMQ_POLLIN, 0 }
         };
-        int rc = zmq_poll(items, zlist_size(available_workers) ? 2 : 1, -1);
+        int rc = zmq_poll(items, available_workers.size ? 2 : 1,
+                PURGE_INTERVAL * ZMQ_POLL_MSEC);
         if (rc == -1)
             break;  // Interrupted
+        workers_purge(workers, &busy_workers);
 
         if (items[0].revents & ZMQ_POLLIN) {
             zmsg_t* msg = zmsg_recv(backend);
+            if (!msg)
+                break;  // Interrupted
             // Strip the identity frame added by REQ socket
-            zframe_t* identity = zmsg_unwrap(msg);
-            zlist_push(available_workers, identity);
+            worker_t* worker = worker_require(workers, zmsg_unwrap(msg));
+            busy_unlink(&busy_workers, worker);
+            ready_push(&available_workers, worker);
             // Check the first frame for READY signal
             zframe_t* frame = zmsg_first(msg);
-            if (memcmp(zframe_data(frame), WORKER_READY, 1) == 0)
+            if (memcmp(zframe_data(frame), WORKER_READY, 1) == 0) {
                 zmsg_destroy(&msg);
-            else
+            } else {
+                // A late reply of a worker taken for dead comes from one we
+                // don't know yet, and tells nothing of its service time
+                if (worker->dispatched_at) {
+                    double elapsed =
+                        (double)(zclock_time() - worker->dispatched_at);
+                    worker->service_time = worker->served
+                        ? 0.8 * worker->service_time + 0.2 * elapsed
+                        : elapsed;
+                    worker->served++;
+                }
                 zmsg_send(&msg, frontend);
+            }
         } else if (items[1].revents & ZMQ_POLLIN) {
             zmsg_t* msg = zmsg_recv(frontend);
             if (msg) {
-                zmsg_wrap(msg, (zframe_t*)zlist_pop(available_workers));
+                worker_t* worker = ready_next(&available_workers, policy);
+                worker->dispatched_at = zclock_time();
+                busy_append(&busy_workers, worker);
+                zmsg_wrap(msg, zframe_dup(worker->identity));
                 zmsg_send(&msg, backend);
             }
         }
     }
 
     // Cleanup
-    while (zlist_size(available_workers)) {
-        zframe_t* identity = (zframe_t*)zlist_pop(available_workers);
-        zframe_destroy(&identity);
-    }
-    zlist_destroy(&available_workers);
+    free(available_workers.items);
+    zhash_destroy(&workers);
     zctx_destroy(&ctx);
     return 0;
 }
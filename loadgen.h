@@ -0,0 +1,163 @@
+/**
+ * @file loadgen.h
+ *
+ * @breif Open-loop load generator, for clients which send requests at a
+ * target rate rather than one after the other's reply. Requests are
+ * scheduled by constant or Poisson (exponential gaps) arrivals, and many of
+ * them can be outstanding at once, each tagged with an id to find it by when
+ * its reply comes. Latency is measured from the time a request was meant to
+ * be sent, not from when it was: if the client falls behind, because the
+ * window of outstanding requests is full or it was busy, the time requests
+ * wait to be sent counts, and a slow server can't hide its slowness by
+ * slowing down the load (coordinated omission).
+ */
+#ifndef _LOADGEN_H
+#define _LOADGEN_H
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOADGEN_OUTSTANDING_MAX 1024  // Requests outstanding at once, at most
+
+typedef enum {
+    LOADGEN_CONSTANT,         // Evenly spaced arrivals
+    LOADGEN_POISSON           // Exponentially distributed gaps
+} loadgen_arrivals_t;
+
+typedef struct {
+    uint32_t id;              // Of the request in this slot
+    int64_t intended_at;      // usecs, when it was meant to be sent, 0 if free
+} loadgen_slot_t;
+
+typedef struct {
+    double rate;              // Requests per second
+    loadgen_arrivals_t arrivals;
+    int window;               // Requests outstanding at once, at most
+    int64_t next_at;          // usecs, next request is meant to go then
+    uint32_t next_id;
+    uint64_t seed;            // Of the generator's own random numbers, so
+                              // that clients in threads don't share rand()
+    loadgen_slot_t slots[LOADGEN_OUTSTANDING_MAX];
+    int free_slots[LOADGEN_OUTSTANDING_MAX];
+    int nbr_free;
+    // Counters
+    uint64_t sent;            // Requests sent
+    uint64_t done;            // Replies taken
+    uint64_t expired;         // Requests given up on
+    int64_t max_behind;       // usecs, most a request went out late
+} loadgen_t;
+
+// loadgen_init - start generating rate requests per second, at most window
+// outstanding, from time now in usecs; seed differs per client
+static inline void loadgen_init(loadgen_t* self, double rate,
+        loadgen_arrivals_t arrivals, int window, int64_t now, uint64_t seed)
+{
+    assert(self);
+    assert(rate > 0);
+    assert(window > 0 && window <= LOADGEN_OUTSTANDING_MAX);
+    memset(self, 0, sizeof(loadgen_t));
+    self->rate = rate;
+    self->arrivals = arrivals;
+    self->window = window;
+    self->seed = seed ? seed : 1;
+    for (int i = 0; i < window; ++i)
+        self->free_slots[self->nbr_free++] = window - 1 - i;
+    self->next_at = now;
+}
+
+// Gap until the next arrival, usecs
+static inline int64_t s_loadgen_gap(loadgen_t* self)
+{
+    double gap = 1e6 / self->rate;
+    if (self->arrivals == LOADGEN_POISSON) {
+        // xorshift64*, uniform in (0, 1]
+        self->seed ^= self->seed >> 12;
+        self->seed ^= self->seed << 25;
+        self->seed ^= self->seed >> 27;
+        uint64_t bits = (self->seed * 2685821657736338717ULL) >> 11;
+        double uniform = (bits + 1.0) / 9007199254740992.0;
+        gap *= -log(uniform);
+    }
+    return (int64_t)(gap + 0.5);
+}
+
+// loadgen_send - if a request is due at time now and the window has room for
+// it, take it: returns 1 with its id, and when it was meant to be sent;
+// call until it returns 0
+static inline int loadgen_send(loadgen_t* self, int64_t now, uint32_t* id,
+        int64_t* intended_at)
+{
+    assert(self);
+    assert(id);
+    if (self->next_at > now || self->nbr_free == 0)
+        return 0;
+    int slot = self->free_slots[--self->nbr_free];
+    // Ids carry their slot, and differ from the last ones of the slot
+    *id = (self->next_id++ << 10) | (uint32_t)slot;
+    self->slots[slot].id = *id;
+    self->slots[slot].intended_at = self->next_at;
+    if (intended_at)
+        *intended_at = self->next_at;
+    if (now - self->next_at > self->max_behind)
+        self->max_behind = now - self->next_at;
+    self->sent++;
+    self->next_at += s_loadgen_gap(self);
+    return 1;
+}
+
+// loadgen_done - the reply of request id came; returns when the request was
+// meant to be sent, usecs, so latency is now less that; -1 if the request
+// isn't outstanding, as it expired or the reply is a duplicate
+static inline int64_t loadgen_done(loadgen_t* self, uint32_t id)
+{
+    assert(self);
+    int slot = id & (LOADGEN_OUTSTANDING_MAX - 1);
+    if (slot >= self->window || self->slots[slot].id != id
+            || self->slots[slot].intended_at == 0)
+        return -1;
+    int64_t intended_at = self->slots[slot].intended_at;
+    self->slots[slot].intended_at = 0;
+    self->free_slots[self->nbr_free++] = slot;
+    self->done++;
+    return intended_at;
+}
+
+// loadgen_expire - give up on a request meant to be sent before time
+// before: returns 1 with its id and when it was meant to be sent; call until
+// it returns 0
+static inline int loadgen_expire(loadgen_t* self, int64_t before,
+        uint32_t* id, int64_t* intended_at)
+{
+    assert(self);
+    assert(id);
+    for (int slot = 0; slot < self->window; ++slot) {
+        loadgen_slot_t* entry = &self->slots[slot];
+        if (entry->intended_at && entry->intended_at < before) {
+            *id = entry->id;
+            if (intended_at)
+                *intended_at = entry->intended_at;
+            entry->intended_at = 0;
+            self->free_slots[self->nbr_free++] = slot;
+            self->expired++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// loadgen_wait - msecs until the next request is due, for poll timeouts; -1
+// while the window is full, the next reply makes room
+static inline int loadgen_wait(const loadgen_t* self, int64_t now)
+{
+    assert(self);
+    if (self->nbr_free == 0)
+        return -1;
+    if (self->next_at <= now)
+        return 0;
+    return (int)((self->next_at - now + 999) / 1000);
+}
+
+#endif // _LOADGEN_H
@@ -0,0 +1,118 @@
+/**
+ * @file rtt.h
+ *
+ * @breif Round-trip time estimator, for clients which retry requests after
+ * a timeout. Keeps a smoothed RTT and its mean deviation the way TCP does
+ * (Jacobson/Karels), so the timeout follows the network: a few msecs on a
+ * LAN, seconds for a slow batch service. The timeout is also capped at a
+ * multiple of a high percentile of recent samples, so a single very slow
+ * reply doesn't inflate the deviation, and the timeout, for long.
+ * Samples must only be taken from requests which were sent once (Karn's
+ * rule), a reply to a request sent twice can't tell which one it answers.
+ */
+#ifndef _RTT_H
+#define _RTT_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RTT_SAMPLES 128       // Recent samples kept for the percentile cap
+#define RTT_PERCENTILE 99     // Percentile of recent samples ...
+#define RTT_CAP_FACTOR 2      // ... times this caps the timeout
+#define RTT_BACKOFF_MAX 6     // Timeout doubles at most this many times
+
+typedef struct {
+    int initial;              // Timeout before any sample, msecs
+    int min;                  // Timeout bounds, msecs
+    int max;
+    double srtt;              // Smoothed RTT, usecs
+    double rttvar;            // Smoothed mean deviation of RTT, usecs
+    int64_t samples[RTT_SAMPLES];
+    size_t nbr_samples;       // Samples taken so far
+    int backoff;              // Timeouts since the last sample
+} rtt_t;
+
+// rtt_init - start an estimator with the timeout to use until the first
+// sample, and the bounds of the timeout
+static inline void rtt_init(rtt_t* self, int initial, int min, int max)
+{
+    assert(self);
+    assert(min > 0 && min <= initial && initial <= max);
+    memset(self, 0, sizeof(rtt_t));
+    self->initial = initial;
+    self->min = min;
+    self->max = max;
+}
+
+// rtt_sample - take the RTT of a request sent once, in usecs
+static inline void rtt_sample(rtt_t* self, int64_t rtt)
+{
+    assert(self);
+    if (rtt < 0)
+        rtt = 0;
+    if (self->nbr_samples == 0) {
+        self->srtt = (double)rtt;
+        self->rttvar = rtt / 2.0;
+    } else {
+        double error = rtt - self->srtt;
+        self->rttvar += ((error < 0 ? -error : error) - self->rttvar) / 4;
+        self->srtt += error / 8;
+    }
+    self->samples[self->nbr_samples++ % RTT_SAMPLES] = rtt;
+    self->backoff = 0;
+}
+
+// rtt_backoff - a request timed out, double the timeout until the next sample
+static inline void rtt_backoff(rtt_t* self)
+{
+    assert(self);
+    if (self->backoff < RTT_BACKOFF_MAX)
+        self->backoff++;
+}
+
+static inline int s_rtt_compare(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// rtt_percentile - percentile of recent samples, usecs; the initial timeout
+// if there is no sample yet
+static inline double rtt_percentile(const rtt_t* self, int percentile)
+{
+    assert(self);
+    assert(percentile >= 0 && percentile <= 100);
+    if (self->nbr_samples == 0)
+        return self->initial * 1000.0;
+    size_t size = self->nbr_samples < RTT_SAMPLES
+        ? self->nbr_samples : RTT_SAMPLES;
+    int64_t sorted[RTT_SAMPLES];
+    memcpy(sorted, self->samples, size * sizeof(int64_t));
+    qsort(sorted, size, sizeof(int64_t), s_rtt_compare);
+    return (double)sorted[(size - 1) * percentile / 100];
+}
+
+// rtt_timeout - how long to wait for a reply, msecs
+static inline int rtt_timeout(const rtt_t* self)
+{
+    assert(self);
+    double timeout = self->initial;
+    if (self->nbr_samples) {
+        timeout = (self->srtt + 4 * self->rttvar) / 1000;
+        double cap = RTT_CAP_FACTOR * rtt_percentile(self, RTT_PERCENTILE)
+            / 1000;
+        if (timeout > cap)
+            timeout = cap;
+    }
+    timeout *= 1 << self->backoff;
+    if (timeout < self->min)
+        timeout = self->min;
+    if (timeout > self->max)
+        timeout = self->max;
+    return (int)(timeout + 0.5);
+}
+
+#endif // _RTT_H
@@ -0,0 +1,104 @@
+/**
+ * @file slab.h
+ *
+ * @breif Fixed-size object pool, for objects the brokers create and destroy
+ * on every message (workers, services, queue nodes). Objects are carved out
+ * of slabs taken from the heap and recycled through a free list, so once the
+ * pool has grown to its peak size, allocating and freeing objects never hits
+ * the heap again. The counters let callers check that is indeed the case.
+ */
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    size_t object_size;       // Object size, rounded up for alignment
+    size_t objects_per_slab;  // Objects taken from the heap at once
+    void* slabs;              // Slabs taken so far, linked by first word
+    void* free_list;          // Free objects, linked by first word
+    // Counters
+    uint64_t allocs;          // Objects handed out
+    uint64_t frees;           // Objects given back
+    uint64_t heap_allocs;     // Slabs taken from the heap
+    size_t in_use;            // Objects currently handed out
+} slab_t;
+
+// slab_new - create a pool of objects of the specified size
+static inline slab_t* slab_new(size_t object_size, size_t objects_per_slab)
+{
+    assert(object_size > 0);
+    assert(objects_per_slab > 0);
+    slab_t* self = (slab_t*)calloc(1, sizeof(slab_t));
+    assert(self);
+    size_t align = sizeof(void*) > sizeof(uint64_t)
+        ? sizeof(void*) : sizeof(uint64_t);
+    self->object_size = (object_size + align - 1) / align * align;
+    self->objects_per_slab = objects_per_slab;
+    return self;
+}
+
+// slab_destroy - give all slabs back to the heap, objects still in use
+// become invalid
+static inline void slab_destroy(slab_t** self_p)
+{
+    assert(self_p);
+    if (*self_p) {
+        slab_t* self = *self_p;
+        while (self->slabs) {
+            void* slab = self->slabs;
+            self->slabs = *(void**)slab;
+            free(slab);
+        }
+        free(self);
+        *self_p = NULL;
+    }
+}
+
+// slab_alloc - hand out a zeroed object, growing the pool by one slab if no
+// free object is left
+static inline void* slab_alloc(slab_t* self)
+{
+    assert(self);
+    if (!self->free_list) {
+        // Slab header is one object wide, to keep objects aligned
+        size_t size = self->object_size * (self->objects_per_slab + 1);
+        char* slab = (char*)malloc(size);
+        assert(slab);
+        *(void**)slab = self->slabs;
+        self->slabs = slab;
+        self->heap_allocs++;
+        size_t i;
+        for (i = self->objects_per_slab; i > 0; i--) {
+            void* object = slab + i * self->object_size;
+            *(void**)object = self->free_list;
+            self->free_list = object;
+        }
+    }
+    void* object = self->free_list;
+    self->free_list = *(void**)object;
+    memset(object, 0, self->object_size);
+    self->allocs++;
+    self->in_use++;
+    return object;
+}
+
+// slab_free - give an object back to the pool; the first pointer-sized word
+// of the object is used to link it in the free list, the rest is untouched
+// until the object is handed out again
+static inline void slab_free(slab_t* self, void* object)
+{
+    assert(self);
+    if (object) {
+        assert(self->in_use > 0);
+        *(void**)object = self->free_list;
+        self->free_list = object;
+        self->frees++;
+        self->in_use--;
+    }
+}
+
+#endif // _SLAB_H